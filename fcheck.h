@@ -0,0 +1,132 @@
+#ifndef _FCHECK_H_
+#define _FCHECK_H_
+
+// Library interface of the xv6 file system checker.
+// A context checks one image at a time and can be reused for any number of images;
+// nothing in the library prints or exits, results are returned to the caller.
+// Build: gcc -O2 -pthread -c libfcheck.c, then link with -pthread.
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Errors fcheck can report, listed in the order the checks report them by default.
+// FCHECK_ERR_NONE is 0 so zeroed memory means no error.
+enum fcheck_error {
+  FCHECK_ERR_NONE,
+  FCHECK_ERR_BAD_INODE,     // test 1
+  FCHECK_ERR_NO_ROOT,       // test 3
+  FCHECK_ERR_BITMAP_FREE,   // test 5
+  FCHECK_ERR_REF_FREE,      // test 10
+  FCHECK_ERR_DIR_FORMAT,    // test 4
+  FCHECK_ERR_NOT_IN_DIR,    // test 9
+  FCHECK_ERR_BAD_DIRECT,    // test 2
+  FCHECK_ERR_BAD_INDIRECT,  // test 2
+  FCHECK_ERR_BITMAP_USED,   // test 6
+  FCHECK_ERR_DUP_DIRECT,    // test 7
+  FCHECK_ERR_DUP_INDIRECT,  // test 8
+  FCHECK_ERR_REFCOUNT,      // test 11
+  FCHECK_ERR_DIR_LINKS,     // test 12
+  FCHECK_ERR_PARENT,        // test 13
+  FCHECK_ERR_UNREACHABLE,   // test 14
+  FCHECK_ERR_SIZE_SHORT,    // test 15
+  FCHECK_ERR_PAST_EOF,      // test 15
+  FCHECK_ERR_DEVICE,        // test 16
+  FCHECK_ERR_DIR_SIZE,      // test 17
+  FCHECK_ERR_DUP_NAME,      // test 18
+  FCHECK_ERR_BAD_NAME,      // test 19
+  FCHECK_ERR_NO_MEMORY,     // the check ran out of memory, not a test
+  FCHECK_NERRORS
+};
+
+// Ways of getting an image into memory.
+enum fcheck_io {
+  FCHECK_IO_MMAP,    // map the image file, with madvise hints
+  FCHECK_IO_PREAD,   // read the blocks fcheck looks at with pread
+  FCHECK_IO_DIRECT,  // like FCHECK_IO_PREAD but with O_DIRECT, bypassing the page cache
+  FCHECK_NIO
+};
+
+// One error found in an image.
+struct fcheck_result {
+  int err;          // enum fcheck_error
+  int inum;         // inode the error is about, -1 if none
+  long block;       // block the error is about, -1 if none
+  char name[15];    // directory entry name (DIRSIZ + 1), empty if none
+};
+
+// Called once for every error found by fcheck_run, in report order, on the thread that called it.
+typedef void (*fcheck_callback)(void *arg, const struct fcheck_result *r);
+
+// Settings of a context, a zeroed struct gives the defaults.
+struct fcheck_options {
+  int nthreads;             // threads for the inode scan and directory walk, 0 for 1
+  bool all;                 // find every error instead of stopping at the first one
+  bool paths;               // record the path of every inode the directory walk finds, for fcheck_path
+  size_t mem_limit;         // most bytes a check may use, 0 for no limit
+  int io;                   // enum fcheck_io, used when the library opens the image
+  int block_size;           // 512, 1024 or 4096, 0 to detect it from the superblock
+  fcheck_callback on_error; // called for each error, may be NULL
+  void *arg;                // passed to on_error
+};
+
+struct fcheck;
+
+// Create a context, opts may be NULL for the defaults.
+// Returns NULL if memory runs out.
+struct fcheck* fcheck_create(const struct fcheck_options *opts);
+void fcheck_destroy(struct fcheck *fc);
+
+// Open an image for checking.
+// Each returns NULL on success or a message saying why the image can't be checked.
+// fcheck_open_fd leaves fd open and owned by the caller, FCHECK_IO_DIRECT needs the caller
+// to have opened it with O_DIRECT; fcheck_open_buffer checks size bytes at buf in place,
+// the buffer is never written and must stay valid until fcheck_close.
+const char* fcheck_open(struct fcheck *fc, const char *path);
+const char* fcheck_open_fd(struct fcheck *fc, int fd);
+const char* fcheck_open_buffer(struct fcheck *fc, const void *buf, size_t size);
+void fcheck_close(struct fcheck *fc);
+
+// Run every check on the open image.
+// Returns the number of errors found, 0 for a good image; by default the check stops
+// at the first error, with opts->all every error is found.
+// If memory runs out the only result is FCHECK_ERR_NO_MEMORY.
+int fcheck_run(struct fcheck *fc);
+
+// Errors found by the last fcheck_run, valid until the next run or fcheck_close.
+const struct fcheck_result* fcheck_results(struct fcheck *fc, int *count);
+
+// Roles a block can have in the inode that owns it.
+enum fcheck_role {
+  FCHECK_ROLE_NONE,            // no inode points to the block
+  FCHECK_ROLE_DIRECT,          // a direct address of the inode
+  FCHECK_ROLE_INDIRECT,        // an address in the inode's indirect block
+  FCHECK_ROLE_INDIRECT_BLOCK,  // the inode's indirect block itself
+};
+
+// Owner of a block, from the reverse index the inode scan builds.
+struct fcheck_owner {
+  int role;      // enum fcheck_role
+  int inum;      // owning inode, the first in inode order if several point to the block, -1 if none
+  int offset;    // logical block of the file held in the block, -1 if none or for the indirect block
+  bool shared;   // another direct or indirect address points to the block too (test 7/8)
+};
+
+// Owner of a block of the image checked by the last fcheck_run, answered in O(1).
+// Returns false if the block is outside the file system or the run stopped before
+// every inode was scanned (a bad inode or a missing root without opts->all).
+bool fcheck_who_owns(struct fcheck *fc, long block, struct fcheck_owner *o);
+
+// Path from the root of an inode of the image checked by the last fcheck_run, written to buf
+// like snprintf. Needs opts->paths; an inode named by several entries gets the one in the lowest
+// directory, the first entry there. Returns the length of the whole path, or -1 if the walk
+// found no path to the inode, the run stopped before the walk or paths weren't recorded.
+int fcheck_path(struct fcheck *fc, int inum, char *buf, size_t size);
+
+// Message and test case number of an error, test 0 for errors that aren't a test.
+const char* fcheck_strerror(int err);
+int fcheck_test_number(int err);
+
+// enum fcheck_io for a backend name ("mmap", "pread" or "direct"), -1 if unknown.
+int fcheck_io_parse(const char *name);
+
+#endif // _FCHECK_H_
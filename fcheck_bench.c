@@ -0,0 +1,195 @@
+//Microbenchmark of the fcheck phases
+//times each phase of a check on its own, with warmup runs, and reports the median and p99 per image
+//the state a phase needs is rebuilt before every repetition without being timed
+//build with: gcc -O2 -pthread fcheck_bench.c -o fcheck_bench
+#include "libfcheck.c"									//the phases are internal to the library
+#include <getopt.h>
+#include <time.h>
+
+//Phases that can be timed, in the order a check runs them
+enum bench_phase {
+ P_RESET,			//fcheck_reset, laying out the arena
+ P_VALID,			//invalid_inodes over the whole inode table
+ P_GETBIT,			//get_bit over every block
+ P_SCAN,			//scan_inodes, the fused inode table scan
+ P_WALK,			//print_directory_contents from the root
+ P_TEST9,
+ P_TEST2,
+ P_TEST6,
+ P_TEST78,
+ P_TEST11,
+ P_TEST12,
+ P_TEST13,
+ P_TEST14,
+ P_TEST15,
+ P_TEST16,
+ P_TEST17,
+ P_TEST18,
+ P_TEST19,
+ P_RUN,				//fcheck_run, the whole check
+ NPHASES
+};
+
+const char* phase_names[NPHASES] = {
+ [P_RESET]  = "reset",
+ [P_VALID]  = "invalid_inodes",
+ [P_GETBIT] = "get_bit",
+ [P_SCAN]   = "scan_inodes",
+ [P_WALK]   = "print_directory_contents",
+ [P_TEST9]  = "test9",
+ [P_TEST2]  = "test2",
+ [P_TEST6]  = "test6",
+ [P_TEST78] = "test78",
+ [P_TEST11] = "test11",
+ [P_TEST12] = "test12",
+ [P_TEST13] = "test13",
+ [P_TEST14] = "test14",
+ [P_TEST15] = "test15",
+ [P_TEST16] = "test16",
+ [P_TEST17] = "test17",
+ [P_TEST18] = "test18",
+ [P_TEST19] = "test19",
+ [P_RUN]    = "fcheck_run",
+};
+
+volatile long sink;		//keeps the loops over invalid_inodes and get_bit from being optimised away
+
+//Run one repetition of a phase
+//returns its time in nanoseconds, or -1 if the image failed a check before or during the phase
+double bench_once(struct fcheck *fc, int phase){
+ struct timespec start, end;
+ struct fcheck_result r;
+ int err = FCHECK_ERR_NONE;
+ long sum = 0;
+ uint i;
+
+ if (setjmp(fc->bail) != 0) {return -1;}
+ if (phase != P_RESET && phase != P_RUN) {fcheck_reset(fc);}
+ if (phase >= P_WALK && phase < P_RUN) {scan_inodes(fc);}
+ if (phase >= P_TEST9 && phase < P_RUN) {err = walk_root(fc, &r);}
+ if (err != FCHECK_ERR_NONE) {goto failed;}
+
+ clock_gettime(CLOCK_MONOTONIC, &start);
+ switch (phase){
+ case P_RESET: fcheck_reset(fc); break;
+ case P_VALID:
+  for (i = 0; i <= fc->sb->ninodes; i += VLANES) {sum += invalid_inodes(fc, fc->lg, i, MIN(VLANES, fc->sb->ninodes + 1 - i));}
+  break;
+ case P_GETBIT:
+  for (i = 0; i < fc->sb->size; i++) {sum += get_bit(fc, fc->lg, i);}
+  break;
+ case P_SCAN: scan_inodes(fc); break;
+ case P_WALK: err = walk_root(fc, &r); break;
+ case P_TEST9: err = test9(fc, &r); break;
+ case P_TEST2: err = test2(fc, &r); break;
+ case P_TEST6: err = test6(fc, &r); break;
+ case P_TEST78: err = test78(fc, &r); break;
+ case P_TEST11: err = test11(fc, &r); break;
+ case P_TEST12: err = test12(fc, &r); break;
+ case P_TEST13: err = test13(fc, &r); break;
+ case P_TEST14: err = test14(fc, &r); break;
+ case P_TEST15: err = test15(fc, &r); break;
+ case P_TEST16: err = test16(fc, &r); break;
+ case P_TEST17: err = test17(fc, &r); break;
+ case P_TEST18: err = test18(fc, &r); break;
+ case P_TEST19: err = test19(fc, &r); break;
+ case P_RUN: fcheck_run(fc); break;
+ }
+ clock_gettime(CLOCK_MONOTONIC, &end);
+ if (err != FCHECK_ERR_NONE) {goto failed;}
+
+ sink = sum;
+ return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+failed:
+ fc->result = err;										//scheduled checks return their error instead of failing
+ return -1;
+}
+
+//qsort comparator for times
+int compare_times(const void *a, const void *b){
+ double x = *(const double *)a, y = *(const double *)b;
+ return (x > y) - (x < y);
+}
+
+//Time every phase on one open image and print a line per phase
+//returns false if the image failed a check, its remaining phases are skipped
+bool bench_image(struct fcheck *fc, const char *path, int warmup, int reps, double *times){
+ int phase, r;
+
+ for (phase = 0; phase < NPHASES; phase++){
+  for (r = 0; r < warmup; r++){
+   if (bench_once(fc, phase) < 0) {goto failed;}
+  }
+  for (r = 0; r < reps; r++){
+   if ((times[r] = bench_once(fc, phase)) < 0) {goto failed;}
+  }
+  qsort(times, reps, sizeof(double), compare_times);
+  double median = (reps % 2) ? times[reps / 2] : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+  double p99 = times[(reps * 99 + 99) / 100 - 1];						//nearest rank
+  printf("%s\t%s\t%.3f us\t%.3f us\n", path, phase_names[phase], median / 1e3, p99 / 1e3);
+ }
+ return true;
+
+failed:
+ printf("%s\t%s\tfailed\t%s\n", path, phase_names[phase], error_info[fc->result].msg);
+ return false;
+}
+
+int
+main(int argc, char *argv[]){
+ struct fcheck fc;
+ int warmup = 3, reps = 31;
+ int opt, i, failed = 0;
+
+ fcheck_init(&fc);
+ struct option long_options[] = {
+  {"all", no_argument, NULL, 'a'},								//time the --all code paths
+  {"paths", no_argument, NULL, 'p'},								//build the path table in the walk
+  {"io", required_argument, NULL, 'i'},								//how to read the image
+  {NULL, 0, NULL, 0}
+ };
+ while((opt = getopt_long(argc, argv, "j:r:w:", long_options, NULL)) != -1){			//parse options
+  if(opt == 'j' && atoi(optarg) > 0){
+   fc.nthreads = atoi(optarg);
+  } else if(opt == 'r' && atoi(optarg) > 0){
+   reps = atoi(optarg);
+  } else if(opt == 'w' && atoi(optarg) >= 0){
+   warmup = atoi(optarg);
+  } else if(opt == 'a'){
+   fc.all_mode = true;
+  } else if(opt == 'p'){
+   fc.want_paths = true;
+  } else if(opt == 'i'){
+   fc.io = fcheck_io_parse(optarg);
+   if(fc.io < 0) {optind = argc;}
+  } else {
+   optind = argc;
+   break;
+  }
+ }
+ if(optind >= argc){
+  fprintf(stderr, "Usage: fcheck_bench [-j threads] [-r repetitions] [-w warmup] [--all] [--paths] [--io mmap|pread|direct] <file_system_image>...\n");
+  exit(1);
+ }
+
+ double *times = (double *)malloc(reps * sizeof(double));
+ if(times == NULL){
+  fprintf(stderr, "out of memory.\n");
+  exit(1);
+ }
+ printf("image\tphase\tmedian\tp99\n");
+ for(i = optind; i < argc; i++){
+  const char *msg = fcheck_open(&fc, argv[i]);
+  if(msg != NULL){
+   printf("%s\topen\tfailed\t%s\n", argv[i], msg);
+   failed++;
+   continue;
+  }
+  failed += !bench_image(&fc, argv[i], warmup, reps, times);
+  fcheck_close(&fc);
+ }
+ free(times);
+ fcheck_free(&fc);
+ exit(failed > 0);
+}
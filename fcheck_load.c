@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+//Load generator for fcheckd
+//opens a number of connections, sends each one a series of check requests over the given images
+//(by path, or with --fd as descriptors passed with SCM_RIGHTS), waits for every verdict before
+//sending the next request, then reports requests per second and the latency distribution
+//build with: gcc -O2 -pthread fcheck_load.c -o fcheck_load
+
+//One connection of the load and what it measured
+struct client {
+ int id;
+ double* latency;		//milliseconds of each measured request
+ int done;			//measured requests answered
+ int answered;			//requests answered, warmup included
+ int ok, failed, errors;	//verdicts by status
+ bool broken;			//the daemon closed the connection or could not be reached
+};
+
+const char *sock_path;
+char **images;
+int nimages;
+int requests = 1000;		//measured requests per connection
+int warmup = 10;		//unmeasured requests per connection
+bool pass_fd;
+
+//Helper function to connect to the daemon
+//returns the socket, or -1 if the daemon can't be reached
+int connect_daemon(void){
+ struct sockaddr_un addr = {.sun_family = AF_UNIX};
+ snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+ int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+ if (sock < 0) {return -1;}
+ if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+  close(sock);
+  return -1;
+ }
+ return sock;
+}
+
+//Send one request for an image, passing its descriptor with --fd
+//returns false if it could not be sent
+bool send_request(int sock, const char *image){
+ char line[PATH_MAX + 16];
+ if (!pass_fd){
+  int n = snprintf(line, sizeof(line), "check %s\n", image);
+  return send(sock, line, n, MSG_NOSIGNAL) == n;
+ }
+
+ int fd = open(image, O_RDONLY);
+ if (fd < 0) {return false;}
+ union {
+  struct cmsghdr hdr;
+  char buf[CMSG_SPACE(sizeof(int))];
+ } control;
+ struct iovec iov = {"checkfd\n", 8};
+ struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+ struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+ cm->cmsg_level = SOL_SOCKET;
+ cm->cmsg_type = SCM_RIGHTS;
+ cm->cmsg_len = CMSG_LEN(sizeof(int));
+ memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+ bool sent = sendmsg(sock, &msg, MSG_NOSIGNAL) == 8;
+ close(fd);											//the daemon holds its own copy
+ return sent;
+}
+
+//Read one verdict and the error lines that follow it
+//returns the status word's first letter (o, f or e), or 0 if the connection ended
+int read_verdict(FILE *in){
+ char line[1024];
+ int nerrors = 0;
+ if (fgets(line, sizeof(line), in) == NULL) {return 0;}
+ int status = line[0];
+ sscanf(line, "%*s %d", &nerrors);
+ for (int i = 0; i < nerrors; i++){
+  if (fgets(line, sizeof(line), in) == NULL) {return 0;}
+ }
+ return status;
+}
+
+//Thread function for one connection
+void* run_client(void *arg){
+ struct client *c = arg;
+ struct timespec start, end;
+ int sock = connect_daemon();
+ if (sock < 0){
+  c->broken = true;
+  return NULL;
+ }
+ FILE *in = fdopen(dup(sock), "r");
+
+ for (int i = 0; i < warmup + requests; i++){
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int status = send_request(sock, images[(c->id + i) % nimages]) ? read_verdict(in) : 0;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (status == 0){
+   c->broken = true;
+   break;
+  }
+  c->answered++;
+  if (i < warmup) {continue;}
+  c->latency[c->done++] = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+  c->ok += status == 'o';
+  c->failed += status == 'f';
+  c->errors += status == 'e';
+ }
+ fclose(in);
+ close(sock);
+ return NULL;
+}
+
+//qsort comparator for times
+int compare_times(const void *a, const void *b){
+ double x = *(const double *)a, y = *(const double *)b;
+ return (x > y) - (x < y);
+}
+
+//Helper function for a percentile of sorted times, nearest rank
+double percentile(double *t, int n, double p){
+ int rank = (int)(p / 100 * n + 0.999999);
+ return t[(rank < 1 ? 1 : rank) - 1];
+}
+
+const char usage[] = "Usage: fcheck_load [-c connections] [-n requests] [-w warmup] [--fd] <socket_path> <file_system_image>...\n";
+
+int
+main(int argc, char *argv[]){
+ int nclients = 4;
+ int opt, k, i;
+ struct timespec start, end;
+
+ struct option long_options[] = {
+  {"fd", no_argument, NULL, 'f'},								//pass descriptors instead of paths
+  {NULL, 0, NULL, 0}
+ };
+ while((opt = getopt_long(argc, argv, "c:n:w:", long_options, NULL)) != -1){			//parse options
+  if(opt == 'c' && atoi(optarg) > 0){
+   nclients = atoi(optarg);
+  } else if(opt == 'n' && atoi(optarg) > 0){
+   requests = atoi(optarg);
+  } else if(opt == 'w' && atoi(optarg) >= 0){
+   warmup = atoi(optarg);
+  } else if(opt == 'f'){
+   pass_fd = true;
+  } else {
+   fprintf(stderr, "%s", usage);
+   exit(1);
+  }
+ }
+ if(argc - optind < 2){
+  fprintf(stderr, "%s", usage);
+  exit(1);
+ }
+ sock_path = argv[optind];
+ nimages = argc - optind - 1;
+ images = calloc(nimages, sizeof(char *));
+ for(i = 0; i < nimages; i++){									//the daemon resolves paths from its own directory
+  images[i] = realpath(argv[optind + 1 + i], NULL);
+  if(images[i] == NULL){
+   fprintf(stderr, "fcheck_load: %s not found.\n", argv[optind + 1 + i]);
+   exit(1);
+  }
+ }
+
+ struct client *clients = calloc(nclients, sizeof(struct client));
+ pthread_t *threads = calloc(nclients, sizeof(pthread_t));
+ double *all = malloc((size_t)nclients * requests * sizeof(double));
+ if(clients == NULL || threads == NULL || all == NULL){
+  fprintf(stderr, "fcheck_load: out of memory.\n");
+  exit(1);
+ }
+
+ clock_gettime(CLOCK_MONOTONIC, &start);
+ for(k = 0; k < nclients; k++){
+  clients[k].id = k;
+  clients[k].latency = all + (size_t)k * requests;
+  if(pthread_create(&threads[k], NULL, run_client, &clients[k]) != 0){
+   fprintf(stderr, "fcheck_load: unable to start client thread.\n");
+   exit(1);
+  }
+ }
+ for(k = 0; k < nclients; k++){
+  pthread_join(threads[k], NULL);
+ }
+ clock_gettime(CLOCK_MONOTONIC, &end);
+ double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+ int n = 0, answered = 0, ok = 0, failed = 0, errors = 0, broken = 0;
+ for(k = 0; k < nclients; k++){									//gather the measured times in one array
+  memmove(all + n, clients[k].latency, clients[k].done * sizeof(double));
+  n += clients[k].done;
+  answered += clients[k].answered;
+  ok += clients[k].ok;
+  failed += clients[k].failed;
+  errors += clients[k].errors;
+  broken += clients[k].broken;
+ }
+ if(n == 0){
+  fprintf(stderr, "fcheck_load: no request was answered by %s.\n", sock_path);
+  exit(1);
+ }
+ qsort(all, n, sizeof(double), compare_times);
+
+ printf("requests\t%d (%d ok, %d fail, %d error)\n", n, ok, failed, errors);
+ printf("connections\t%d (%d broken)\n", nclients, broken);
+ printf("throughput\t%.1f req/s\n", answered / secs);
+ printf("latency\tp50 %.3f ms\tp90 %.3f ms\tp99 %.3f ms\tp99.9 %.3f ms\tmax %.3f ms\n",
+        percentile(all, n, 50), percentile(all, n, 90), percentile(all, n, 99), percentile(all, n, 99.9), all[n - 1]);
+
+ for(i = 0; i < nimages; i++) {free(images[i]);}
+ free(images);
+ free(all);
+ free(clients);
+ free(threads);
+ exit(broken > 0);
+}
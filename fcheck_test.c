@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <time.h>
+
+//Regression runner for fcheck
+//runs fcheck on every image listed in fcheck_testcases/expected and compares the exit status
+//and the exact stderr with the expected ones, then compares the median wall time of each image
+//with the baseline in fcheck_testcases/timing and fails if it got slower by more than the threshold,
+//and the largest peak RSS with the baseline RSS, failing if it grew by more than the RSS threshold
+//--update writes the measured times and peak RSS as the new baseline
+//build with: gcc -O2 fcheck_test.c -o fcheck_test, or run `make test` to build fcheck from source and check it
+
+#define MAX_IMAGES 256
+#define MAX_ARGS 32
+
+//One image of the suite with its expected and measured results
+struct test_case {
+ char name[64];			//image file in the test directory
+ int status;			//expected exit status
+ char message[256];		//expected stderr, without the newline
+ double baseline_ms;		//median wall time from the timing file, 0 if none
+ double ms;			//median wall time measured
+ long baseline_rss_kb;		//peak RSS from the timing file, 0 if none
+ long rss_kb;			//largest peak RSS measured
+};
+
+struct test_case cases[MAX_IMAGES];
+int ncases;
+
+//Helper function to remove the newline from the end of a line
+void chomp(char *s){
+ s[strcspn(s, "\r\n")] = '\0';
+}
+
+//Read the expected results, lines are name, status and message separated by tabs, # starts a comment
+//returns false if the file can't be read
+bool read_expected(const char *path){
+ char line[512];
+ FILE *f = fopen(path, "r");
+ if (f == NULL) {return false;}
+ while (fgets(line, sizeof(line), f) != NULL && ncases < MAX_IMAGES){
+  chomp(line);
+  if (line[0] == '#' || line[0] == '\0') {continue;}
+  struct test_case *t = &cases[ncases];
+  char *status = strchr(line, '\t');
+  if (status == NULL) {continue;}
+  *status++ = '\0';
+  char *message = strchr(status, '\t');
+  if (message != NULL) {*message++ = '\0';}
+  snprintf(t->name, sizeof(t->name), "%.63s", line);
+  t->status = atoi(status);
+  snprintf(t->message, sizeof(t->message), "%s", message ? message : "");
+  ncases++;
+ }
+ fclose(f);
+ return true;
+}
+
+//Read the timing baseline, lines are name, milliseconds and peak RSS in KiB separated by tabs
+//a missing file leaves every baseline at 0, which is never a regression
+void read_timing(const char *path){
+ char line[512], name[64];
+ double ms;
+ long rss;
+ FILE *f = fopen(path, "r");
+ if (f == NULL) {return;}
+ while (fgets(line, sizeof(line), f) != NULL){
+  if (line[0] == '#' || sscanf(line, "%63s %lf %ld", name, &ms, &rss) != 3) {continue;}
+  for (int i = 0; i < ncases; i++){
+   if (strcmp(cases[i].name, name) == 0) {cases[i].baseline_ms = ms; cases[i].baseline_rss_kb = rss;}
+  }
+ }
+ fclose(f);
+}
+
+bool write_timing(const char *path){
+ FILE *f = fopen(path, "w");
+ if (f == NULL) {return false;}
+ fprintf(f, "# Baseline for fcheck_test: image, median wall time in ms, peak RSS in KiB\n");
+ for (int i = 0; i < ncases; i++){
+  fprintf(f, "%s\t%.3f\t%ld\n", cases[i].name, cases[i].ms, cases[i].rss_kb);
+ }
+ return fclose(f) == 0;
+}
+
+//Run fcheck once on an image, collecting its stderr, exit status, wall time and peak RSS
+//returns false if fcheck could not be started
+bool run_once(char **argv, char *err, size_t errsize, int *status, double *ms, long *rss_kb){
+ int fds[2];
+ struct timespec start, end;
+ struct rusage ru;
+
+ if (pipe(fds) != 0) {return false;}
+ clock_gettime(CLOCK_MONOTONIC, &start);
+ pid_t pid = fork();
+ if (pid < 0) {return false;}
+ if (pid == 0){
+  int null = open("/dev/null", O_WRONLY);
+  dup2(null, STDOUT_FILENO);
+  dup2(fds[1], STDERR_FILENO);
+  close(fds[0]);
+  execv(argv[0], argv);
+  _exit(127);
+ }
+ close(fds[1]);
+
+ size_t len = 0;
+ ssize_t n;
+ char rest[4096];
+ while ((n = (len < errsize - 1) ? read(fds[0], err + len, errsize - 1 - len) : read(fds[0], rest, sizeof(rest))) > 0){
+  if (len < errsize - 1) {len += n;}								//output past errsize is drained so fcheck can't block
+ }
+ err[len] = '\0';
+ chomp(err);
+ close(fds[0]);
+
+ if (wait4(pid, status, 0, &ru) < 0) {return false;}
+ clock_gettime(CLOCK_MONOTONIC, &end);
+ *status = WIFEXITED(*status) ? WEXITSTATUS(*status) : 128 + WTERMSIG(*status);
+ *ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+ *rss_kb = ru.ru_maxrss;
+ return *status != 127;
+}
+
+//qsort comparator for times
+int compare_times(const void *a, const void *b){
+ double x = *(const double *)a, y = *(const double *)b;
+ return (x > y) - (x < y);
+}
+
+const char usage[] = "Usage: fcheck_test [-f fcheck] [-d test_dir] [-r repetitions] [-t threshold_pct] [-s slack_ms] [-m rss_threshold_pct] [-k rss_slack_kib] [--update] [-- fcheck options]\n";
+
+int
+main(int argc, char *argv[]){
+ const char *fcheck = "./fcheck";
+ const char *dir = "fcheck_testcases";
+ int reps = 5;
+ double threshold = 50, slack = 1;							//percent slower, plus ms for timer noise on tiny images
+ double rss_threshold = 25, rss_slack = 256;						//percent larger, plus KiB for libc and page noise
+ bool update = false;
+ int opt, i, r;
+
+ struct option long_options[] = {
+  {"update", no_argument, NULL, 'u'},								//write the measured times as the new baseline
+  {NULL, 0, NULL, 0}
+ };
+ while((opt = getopt_long(argc, argv, "f:d:r:t:s:m:k:", long_options, NULL)) != -1){		//parse options
+  switch(opt){
+  case 'f': fcheck = optarg; break;
+  case 'd': dir = optarg; break;
+  case 'r': reps = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+  case 't': threshold = atof(optarg); break;
+  case 's': slack = atof(optarg); break;
+  case 'm': rss_threshold = atof(optarg); break;
+  case 'k': rss_slack = atof(optarg); break;
+  case 'u': update = true; break;
+  default: fprintf(stderr, "%s", usage); exit(1);
+  }
+ }
+
+ char path[4096], image[4096], err[512];
+ snprintf(path, sizeof(path), "%s/expected", dir);
+ if(!read_expected(path)){
+  fprintf(stderr, "fcheck_test: %s not found.\n", path);
+  exit(1);
+ }
+ snprintf(path, sizeof(path), "%s/timing", dir);
+ read_timing(path);
+
+ char *args[MAX_ARGS + 3];										//fcheck, its options after --, the image
+ int nargs = 0;
+ args[nargs++] = (char *)fcheck;
+ for(i = optind; i < argc && nargs < MAX_ARGS; i++) {args[nargs++] = argv[i];}
+ args[nargs + 1] = NULL;
+
+ double *times = malloc(reps * sizeof(double));
+ int failed = 0, slow = 0, big = 0;
+ printf("image\tresult\tmedian\tbaseline\tpeak rss\tbaseline\n");
+ for(i = 0; i < ncases; i++){
+  struct test_case *t = &cases[i];
+  bool ok = true;
+  snprintf(image, sizeof(image), "%.4000s/%.63s", dir, t->name);
+  args[nargs] = image;
+
+  t->rss_kb = 0;
+  for(r = 0; r < reps; r++){
+   int status;
+   long rss;
+   if(!run_once(args, err, sizeof(err), &status, &times[r], &rss)){
+    fprintf(stderr, "fcheck_test: could not run %s.\n", fcheck);
+    exit(1);
+   }
+   if(status != t->status || strcmp(err, t->message) != 0){
+    if(ok) {printf("%s\tFAIL\texpected %d \"%s\", got %d \"%s\"\n", t->name, t->status, t->message, status, err);}
+    ok = false;
+   }
+   if(rss > t->rss_kb) {t->rss_kb = rss;}
+  }
+  qsort(times, reps, sizeof(double), compare_times);
+  t->ms = times[reps / 2];
+
+  bool regressed = !update && t->baseline_ms > 0 && t->ms > t->baseline_ms * (1 + threshold / 100) + slack;
+  bool grew = !update && t->baseline_rss_kb > 0 && t->rss_kb > t->baseline_rss_kb * (1 + rss_threshold / 100) + rss_slack;
+  if(ok){
+   printf("%s\t%s\t%.3f ms\t", t->name, regressed && grew ? "SLOW,BIG" : regressed ? "SLOW" : grew ? "BIG" : "ok", t->ms);
+   if(t->baseline_ms > 0) {printf("%.3f ms", t->baseline_ms);} else {printf("-");}
+   printf("\t%ld KiB\t", t->rss_kb);
+   if(t->baseline_rss_kb > 0) {printf("%ld KiB\n", t->baseline_rss_kb);} else {printf("-\n");}
+  }
+  failed += !ok;
+  slow += ok && regressed;
+  big += ok && grew;
+ }
+ free(times);
+
+ if(update && !write_timing(path)){
+  fprintf(stderr, "fcheck_test: could not write %s.\n", path);
+  exit(1);
+ }
+ printf("%d images, %d failed, %d slower than the baseline, %d larger than the baseline\n", ncases, failed, slow, big);
+ exit(failed > 0 || slow > 0 || big > 0);
+}
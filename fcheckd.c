@@ -0,0 +1,336 @@
+#define _GNU_SOURCE		//open_memstream
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include "fcheck.h"
+
+//Resident xv6 file system checker answering requests on a Unix domain socket
+//a pool of workers is started once, each with its own context whose arena is reused for every image,
+//so a request pays for the check alone and not for starting a process or faulting in its state
+//build with: gcc -O2 -pthread fcheckd.c libfcheck.c -o fcheckd
+//
+//requests are lines on a stream socket:
+//  check <path>	check the image at path, opened by the daemon
+//  checkfd		check the oldest file descriptor passed on the connection with SCM_RIGHTS
+//each request is answered with a verdict line, followed by one line per error found:
+//  <status>\t<errors>\t<usec>\t<message>		status is ok, fail, or error if the image could not be checked
+//  <test>\t<inode>\t<block>\t<name>\t<message>	-1 for an inode or block the error is not about
+//a connection is served by one worker from its first request to its last
+
+#define MAX_LINE 4096										//longest request
+#define MAX_PASSED 64										//passed descriptors waiting on one connection
+#define MAX_QUEUED 256										//accepted connections waiting for a worker
+
+//Connections accepted but not yet taken by a worker
+struct conn_queue {
+ int socks[MAX_QUEUED];
+ int head;			//next connection to hand out
+ int count;			//connections waiting
+ pthread_mutex_t lock;		//guards the fields above
+ pthread_cond_t ready;		//signalled when a connection is queued
+ pthread_cond_t space;		//signalled when a connection is taken
+};
+
+//State of one connection being served
+struct conn {
+ int sock;
+ char buf[MAX_LINE];		//bytes received but not yet handled
+ size_t len;
+ int passed[MAX_PASSED];	//descriptors received with SCM_RIGHTS, oldest first
+ int npassed;
+};
+
+struct conn_queue queue = {.lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .space = PTHREAD_COND_INITIALIZER};
+struct fcheck_options options;
+const char *warm_image;
+volatile sig_atomic_t stopping;
+
+//Hand an accepted connection to the workers, waits while the queue is full
+void queue_push(int sock){
+ pthread_mutex_lock(&queue.lock);
+ while (queue.count == MAX_QUEUED) {pthread_cond_wait(&queue.space, &queue.lock);}
+ queue.socks[(queue.head + queue.count++) % MAX_QUEUED] = sock;
+ pthread_cond_signal(&queue.ready);
+ pthread_mutex_unlock(&queue.lock);
+}
+
+//Take the oldest accepted connection, waits until there is one
+int queue_pop(void){
+ pthread_mutex_lock(&queue.lock);
+ while (queue.count == 0) {pthread_cond_wait(&queue.ready, &queue.lock);}
+ int sock = queue.socks[queue.head];
+ queue.head = (queue.head + 1) % MAX_QUEUED;
+ queue.count--;
+ pthread_cond_signal(&queue.space);
+ pthread_mutex_unlock(&queue.lock);
+ return sock;
+}
+
+//Helper function to send a whole buffer
+//returns false if the client went away
+bool send_all(int sock, const char *p, size_t n){
+ while (n > 0){
+  ssize_t sent = send(sock, p, n, MSG_NOSIGNAL);
+  if (sent < 0 && errno == EINTR) {continue;}
+  if (sent <= 0) {return false;}
+  p += sent;
+  n -= sent;
+ }
+ return true;
+}
+
+//Receive more request bytes, keeping any descriptors passed along with them
+//returns false at the end of the connection or if the request line is too long
+bool conn_read(struct conn *c){
+ union {
+  struct cmsghdr hdr;
+  char buf[CMSG_SPACE(16 * sizeof(int))];
+ } control;
+ struct iovec iov = {c->buf + c->len, sizeof(c->buf) - c->len};
+ struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+ ssize_t n;
+
+ if (c->len == sizeof(c->buf)) {return false;}
+ do {
+  n = recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC);
+ } while (n < 0 && errno == EINTR);
+
+ struct cmsghdr *cm;
+ for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)){
+  if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {continue;}
+  int *fds = (int *)CMSG_DATA(cm);
+  int i, nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  for (i = 0; i < nfds; i++){
+   if (c->npassed < MAX_PASSED) {c->passed[c->npassed++] = fds[i];}
+   else {close(fds[i]);}									//too many unclaimed descriptors
+  }
+ }
+ if (n <= 0) {return false;}
+ c->len += n;
+ return true;
+}
+
+//Check one image and write its verdict to out
+//exactly one of path and fd is used, fd is owned by the caller
+void check_image(struct fcheck *fc, FILE *out, const char *path, int fd){
+ struct timespec start, end;
+ const struct fcheck_result *results = NULL;
+ int count = 0, i;
+
+ clock_gettime(CLOCK_MONOTONIC, &start);
+ const char *msg = (path != NULL) ? fcheck_open(fc, path) : fcheck_open_fd(fc, fd);
+ if (msg == NULL){
+  fcheck_run(fc);
+  results = fcheck_results(fc, &count);
+ }
+ clock_gettime(CLOCK_MONOTONIC, &end);
+ long usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+
+ if (msg != NULL){
+  fprintf(out, "error\t0\t%ld\t%s\n", usec, msg);
+  return;
+ }
+ fprintf(out, "%s\t%d\t%ld\t%s\n", count ? "fail" : "ok", count, usec, count ? fcheck_strerror(results[0].err) : "ok");
+ for (i = 0; i < count; i++){
+  const struct fcheck_result *e = &results[i];
+  fprintf(out, "%d\t%d\t%ld\t%s\t%s\n", fcheck_test_number(e->err), e->inum, e->block, e->name, fcheck_strerror(e->err));
+ }
+ fcheck_close(fc);
+}
+
+//Answer one request line
+//returns false if the connection should be closed
+bool handle_request(struct fcheck *fc, struct conn *c, char *line){
+ char *resp = NULL;
+ size_t size = 0;
+ FILE *out = open_memstream(&resp, &size);
+ if (out == NULL) {return false;}
+
+ if (strncmp(line, "check ", 6) == 0 && line[6] != '\0'){
+  check_image(fc, out, line + 6, -1);
+ } else if (strcmp(line, "checkfd") == 0){
+  if (c->npassed == 0){
+   fprintf(out, "error\t0\t0\tno file descriptor passed.\n");
+  } else {
+   int fd = c->passed[0];
+   memmove(c->passed, c->passed + 1, --c->npassed * sizeof(int));
+   check_image(fc, out, NULL, fd);
+   close(fd);
+  }
+ } else {
+  fprintf(out, "error\t0\t0\tunknown request.\n");
+ }
+
+ fclose(out);
+ bool ok = send_all(c->sock, resp, size);
+ free(resp);
+ return ok;
+}
+
+//Answer every request of a connection until the client closes it
+void serve(struct fcheck *fc, int sock){
+ struct conn *c = malloc(sizeof(struct conn));
+ char *nl;
+
+ if (c == NULL) {return;}
+ c->sock = sock;
+ c->len = 0;
+ c->npassed = 0;
+ while (conn_read(c)){
+  size_t done = 0;
+  bool open = true;
+  while (open && (nl = memchr(c->buf + done, '\n', c->len - done)) != NULL){
+   *nl = '\0';
+   if (nl > c->buf + done && nl[-1] == '\r') {nl[-1] = '\0';}
+   open = handle_request(fc, c, c->buf + done);
+   done = nl + 1 - c->buf;
+  }
+  if (!open) {break;}
+  memmove(c->buf, c->buf + done, c->len - done);
+  c->len -= done;
+ }
+ while (c->npassed > 0) {close(c->passed[--c->npassed]);}
+ free(c);
+}
+
+//Thread function for a worker
+//the context is created once and warmed on warm_image, so its arena and the checker's pages are
+//already resident when the first request arrives
+void* worker(void *arg){
+ struct fcheck *fc = fcheck_create(&options);
+ (void)arg;
+
+ if (fc == NULL){
+  fprintf(stderr, "fcheckd: out of memory.\n");
+  exit(1);
+ }
+ if (warm_image != NULL && fcheck_open(fc, warm_image) == NULL){
+  fcheck_run(fc);
+  fcheck_close(fc);
+ }
+ while (true){
+  int sock = queue_pop();
+  serve(fc, sock);
+  close(sock);
+ }
+ return NULL;
+}
+
+void on_signal(int sig){
+ (void)sig;
+ stopping = 1;
+}
+
+//Bind the listening socket, replacing a socket file left behind by a daemon that is gone
+//returns the socket, or -1 with a message printed
+int listen_on(const char *path){
+ struct sockaddr_un addr = {.sun_family = AF_UNIX};
+ if (strlen(path) >= sizeof(addr.sun_path)){
+  fprintf(stderr, "fcheckd: socket path too long.\n");
+  return -1;
+ }
+ strcpy(addr.sun_path, path);
+
+ int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+ if (sock < 0) {perror("fcheckd: socket"); return -1;}
+ if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0){
+  fprintf(stderr, "fcheckd: %s is already being served.\n", path);
+  close(sock);
+  return -1;
+ }
+ unlink(path);
+ if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, SOMAXCONN) != 0){
+  perror("fcheckd: bind");
+  close(sock);
+  return -1;
+ }
+ return sock;
+}
+
+const char usage[] = "Usage: fcheckd [-j workers] [-t threads] [--all] [--max-mem MiB] [--io mmap|pread|direct] [--bsize bytes] [--warm image] <socket_path>\n";
+
+int
+main(int argc, char *argv[]){
+ int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+ int opt, k;
+
+ struct option long_options[] = {
+  {"all", no_argument, NULL, 'a'},								//report every error instead of the first
+  {"max-mem", required_argument, NULL, 'm'},							//cap the memory of each check, in MiB
+  {"io", required_argument, NULL, 'i'},								//how to read the image: mmap, pread or direct
+  {"bsize", required_argument, NULL, 's'},							//block size of every image, detected if not given
+  {"warm", required_argument, NULL, 'w'},							//image each worker checks before serving
+  {NULL, 0, NULL, 0}
+ };
+ while((opt = getopt_long(argc, argv, "j:t:", long_options, NULL)) != -1){			//parse options
+  if(opt == 'j' && atoi(optarg) > 0){
+   nworkers = atoi(optarg);									//connections served at once
+  } else if(opt == 't' && atoi(optarg) > 0){
+   options.nthreads = atoi(optarg);								//threads of each check
+  } else if(opt == 'a'){
+   options.all = true;
+  } else if(opt == 'm' && atol(optarg) > 0){
+   options.mem_limit = (size_t)atol(optarg) << 20;
+  } else if(opt == 'i' && fcheck_io_parse(optarg) >= 0){
+   options.io = fcheck_io_parse(optarg);
+  } else if(opt == 's' && atoi(optarg) > 0){
+   options.block_size = atoi(optarg);
+  } else if(opt == 'w'){
+   warm_image = optarg;
+  } else {
+   fprintf(stderr, "%s", usage);
+   exit(1);
+  }
+ }
+ if(optind != argc - 1){
+  fprintf(stderr, "%s", usage);
+  exit(1);
+ }
+
+ int sock = listen_on(argv[optind]);
+ if(sock < 0) {exit(1);}
+
+ struct sigaction sa = {.sa_handler = on_signal};						//no SA_RESTART, so accept returns on a signal
+ sigaction(SIGINT, &sa, NULL);
+ sigaction(SIGTERM, &sa, NULL);
+
+ sigset_t signals;										//only this thread takes the signals
+ sigemptyset(&signals);
+ sigaddset(&signals, SIGINT);
+ sigaddset(&signals, SIGTERM);
+ pthread_sigmask(SIG_BLOCK, &signals, NULL);
+ for(k = 0; k < nworkers; k++){
+  pthread_t thread;
+  if(pthread_create(&thread, NULL, worker, NULL) != 0){
+   fprintf(stderr, "fcheckd: unable to start worker thread.\n");
+   exit(1);
+  }
+  pthread_detach(thread);
+ }
+ pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+ while(!stopping){
+  int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+  if(conn >= 0){
+   queue_push(conn);
+  } else if(errno != EINTR && errno != ECONNABORTED){
+   perror("fcheckd: accept");
+   break;
+  }
+ }
+
+ close(sock);
+ unlink(argv[optind]);
+ exit(stopping ? 0 : 1);
+}
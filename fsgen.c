@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "fs.h"
+#undef BSIZE
+#define BSIZE bsize		//the fs.h sizes (IPB, NINDIRECT, BPB, MAXFILE...) follow the block size given with -b
+
+//Generator of xv6 file system images for benchmarking and testing fcheck
+//builds a tree of directories and files of the requested shape straight into a sparse image file,
+//every choice comes from a seeded generator so the same options always give the same image
+//a corruption can be injected afterwards, one per error class fcheck detects
+//build with: gcc -O2 fsgen.c -o fsgen
+
+#define T_DIR 1		//dir
+#define T_FILE 2	//file
+#define T_DEV 3		//device
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define BLOCK_SIZE (BSIZE)
+#define INODE_ADDR(i) ((struct dinode *)(addr + IBLOCK(i) * BLOCK_SIZE) + ((i) % IPB))	//translate logical block to physical
+#define MAXINODES 65536									//directory entries hold 16 bit inode numbers
+
+uint bsize = 512;		//block size of the image, xv6 uses 512
+
+//Shape of the generated image, set from the command line
+struct options {
+ uint size;			//blocks in the image
+ uint ninodes;			//inodes in the inode table
+ int depth;			//levels of directories below the root
+ int fanout;			//subdirectories in each directory above the last level
+ int files;			//files in each directory
+ int max_blocks;		//largest file without an indirect block, in blocks (at most NDIRECT)
+ int indirect;			//percent of files that are big enough to need an indirect block
+ uint64_t seed;			//seed of the generator
+ const char* corrupt;		//error class to inject, NULL for a good image
+};
+
+char *addr;			//image mapped from the output file
+struct superblock *sb;		//super block of the image
+uint datastart;			//first data block
+uint freeblock;			//next data block to hand out
+uint freeinode = ROOTINO;	//next inode to hand out
+uint ndirs, nfiles;		//inodes created of each kind
+uint64_t rng;			//state of the generator
+
+//Where every inode is linked from, used to pick corruption targets
+uint* parent;			//directory holding the entry, 0 if none
+uint* entry;			//byte offset of the entry in that directory
+
+//xorshift64* generator, returns the next 64 random bits
+uint64_t next_random(void){
+ rng ^= rng >> 12;
+ rng ^= rng << 25;
+ rng ^= rng >> 27;
+ return rng * 0x2545F4914F6CDD1DULL;
+}
+
+//Helper function for a random number in [0, n)
+uint random_below(uint n){
+ return n ? next_random() % n : 0;
+}
+
+//Mark block b in use in the bitmap, or free if used is false
+void set_bit(uint b, bool used){
+ uchar *bitmap = (uchar *)(addr + BBLOCK(0, sb->ninodes) * BLOCK_SIZE);
+ if (used) {bitmap[b / 8] |= 1 << (b % 8);}
+ else {bitmap[b / 8] &= ~(1 << (b % 8));}
+}
+
+//Hand out the next data block and mark it in use
+//returns 0 once the image is full
+uint balloc(void){
+ if (freeblock >= sb->size) {return 0;}
+ set_bit(freeblock, true);
+ return freeblock++;
+}
+
+//Hand out the next inode
+//returns 0 once the inode table is full
+uint ialloc(short type){
+ if (freeinode >= sb->ninodes) {return 0;}
+ struct dinode *ip = INODE_ADDR(freeinode);
+ memset(ip, 0, sizeof(*ip));
+ ip->type = type;
+ ip->nlink = 1;
+ return freeinode++;
+}
+
+//Free every block of an inode in the bitmap
+void free_blocks(struct dinode *ip){
+ for (int i = 0; i < NDIRECT; i++){
+  if (ip->addrs[i] != 0) {set_bit(ip->addrs[i], false);}
+ }
+ if (ip->addrs[NDIRECT] == 0) {return;}
+ uint *indirect = (uint *)(addr + ip->addrs[NDIRECT] * BLOCK_SIZE);
+ for (int i = 0; i < NINDIRECT; i++){
+  if (indirect[i] != 0) {set_bit(indirect[i], false);}
+ }
+ set_bit(ip->addrs[NDIRECT], false);
+}
+
+//Give back the newest inode and its blocks when the image fills up while creating it
+void unalloc(uint inum){
+ struct dinode *ip = INODE_ADDR(inum);
+ free_blocks(ip);
+ memset(ip, 0, sizeof(*ip));
+ freeinode = inum;
+}
+
+//Find block number fbn of an inode, allocating it and the indirect block if needed
+//returns 0 once the image is full
+uint bmap(struct dinode *ip, uint fbn){
+ if (fbn < NDIRECT){
+  if (ip->addrs[fbn] == 0) {ip->addrs[fbn] = balloc();}
+  return ip->addrs[fbn];
+ }
+ if (ip->addrs[NDIRECT] == 0 && (ip->addrs[NDIRECT] = balloc()) == 0) {return 0;}
+ uint *indirect = (uint *)(addr + ip->addrs[NDIRECT] * BLOCK_SIZE);
+ if (indirect[fbn - NDIRECT] == 0) {indirect[fbn - NDIRECT] = balloc();}
+ return indirect[fbn - NDIRECT];
+}
+
+//Append an entry to directory dir
+//returns false if the directory is full or the image ran out of blocks
+bool dir_add(uint dir, uint inum, const char *name){
+ struct dinode *dp = INODE_ADDR(dir);
+ if (dp->size / BLOCK_SIZE >= MAXFILE) {return false;}
+ uint b = bmap(dp, dp->size / BLOCK_SIZE);
+ if (b == 0) {return false;}
+ struct dirent *de = (struct dirent *)(addr + b * BLOCK_SIZE) + (dp->size % BLOCK_SIZE) / sizeof(struct dirent);
+ de->inum = inum;
+ memcpy(de->name, name, MIN(strlen(name), DIRSIZ));						//not terminated when DIRSIZ long
+ if (inum != dir && strcmp(name, "..") != 0){
+  parent[inum] = dir;
+  entry[inum] = dp->size;
+ }
+ dp->size += sizeof(struct dirent);
+ return true;
+}
+
+//Helper function to find the entry of inode inum in its directory
+struct dirent* dir_entry(uint inum){
+ struct dinode *dp = INODE_ADDR(parent[inum]);
+ uint fbn = entry[inum] / BLOCK_SIZE;
+ uint b = (fbn < NDIRECT) ? dp->addrs[fbn] : ((uint *)(addr + dp->addrs[NDIRECT] * BLOCK_SIZE))[fbn - NDIRECT];
+ return (struct dirent *)(addr + b * BLOCK_SIZE) + (entry[inum] % BLOCK_SIZE) / sizeof(struct dirent);
+}
+
+//Create a directory with its "." and ".." entries inside dir (itself for the root)
+//returns 0 once the image is full
+uint make_dir(uint dir, const char *name){
+ uint inum = ialloc(T_DIR);
+ if (inum == 0) {return 0;}
+ if (!dir_add(inum, inum, ".") || !dir_add(inum, dir ? dir : inum, "..") || (dir != 0 && !dir_add(dir, inum, name))){
+  unalloc(inum);
+  return 0;
+ }
+ ndirs++;
+ return inum;
+}
+
+//Create a file of random size in directory dir
+//most files fit in the direct blocks, o->indirect percent of them need the indirect block
+//returns false once the image is full
+bool make_file(struct options *o, uint dir, const char *name){
+ uint inum = ialloc(T_FILE);
+ if (inum == 0) {return false;}
+ struct dinode *ip = INODE_ADDR(inum);
+ uint nblocks = random_below(o->max_blocks + 1);
+ if (random_below(100) < (uint)o->indirect){
+  nblocks = NDIRECT + 1 + random_below(NINDIRECT);
+ }
+ uint fbn;
+ for (fbn = 0; fbn < nblocks && bmap(ip, fbn) != 0; fbn++);
+ ip->size = nblocks ? nblocks * BLOCK_SIZE - random_below(BLOCK_SIZE) : 0;			//last block partly used
+ if (fbn < nblocks || !dir_add(dir, inum, name)){
+  unalloc(inum);
+  return false;
+ }
+ nfiles++;
+ return true;
+}
+
+//Build the tree breadth first, fanout subdirectories and files files in every directory
+//stops early, leaving a consistent image, when the inodes or blocks run out
+void build(struct options *o){
+ uint *queue = calloc(sb->ninodes, sizeof(uint));
+ int *level = calloc(sb->ninodes, sizeof(int));
+ uint head = 0, tail = 0;
+ char name[DIRSIZ + 1];
+
+ queue[tail++] = make_dir(0, "/");
+ while (head < tail){
+  uint dir = queue[head];
+  int lvl = level[head++];
+  for (int i = 0; i < o->files; i++){
+   snprintf(name, sizeof(name), "f%d", i);
+   if (!make_file(o, dir, name)) {goto full;}
+  }
+  for (int i = 0; i < o->fanout && lvl < o->depth; i++){
+   snprintf(name, sizeof(name), "d%d", i);
+   uint child = make_dir(dir, name);
+   if (child == 0) {goto full;}
+   level[tail] = lvl + 1;
+   queue[tail++] = child;
+  }
+ }
+ free(queue);
+ free(level);
+ return;
+
+full:
+ fprintf(stderr, "fsgen: image full, stopped at %u directories and %u files.\n", ndirs, nfiles);
+ free(queue);
+ free(level);
+}
+
+//Helper function to pick a random inode of the given type that is linked from a directory
+//returns 0 if there is none
+uint pick(short type, bool need_indirect){
+ uint n = freeinode - ROOTINO;
+ uint start = random_below(n);
+ for (uint k = 0; k < n; k++){
+  uint inum = ROOTINO + (start + k) % n;
+  struct dinode *ip = INODE_ADDR(inum);
+  if (ip->type == type && parent[inum] != 0 && (!need_indirect || ip->addrs[NDIRECT] != 0) && (need_indirect || ip->addrs[0] != 0)){
+   return inum;
+  }
+ }
+ return 0;
+}
+
+//Corruptions fsgen can inject, named after the fcheck_testcases images that show them
+const char* corruptions[] = {
+ "badinode",	//file with an invalid type (test 1)
+ "badaddr",	//direct address past the end of the image (test 2)
+ "badindir",	//indirect address past the end of the image (test 2)
+ "badroot",	//root directory of size 0 (test 3)
+ "badfmt",	//directory without a "." entry (test 4)
+ "mrkfree",	//direct block in use marked free (test 5)
+ "indirfree",	//block listed in an indirect block marked free (test 5)
+ "mrkused",	//free block marked in use (test 6)
+ "addronce",	//direct block used by two files (test 7)
+ "addronce2",	//indirect address used by two files (test 8)
+ "imrkused",	//file not linked from any directory (test 9)
+ "imrkfree",	//directory entry for a free inode (test 10)
+ "badrefcnt",	//file with one link too many (test 11)
+ "dironce",	//directory with more than one link (test 12)
+ "mismatch",	//".." of a directory pointing at the wrong directory
+ NULL
+};
+
+//Helper function to pick a second inode like pick(), different from inum
+uint pick_other(uint inum, short type, bool need_indirect){
+ for (int tries = 0; tries < 64; tries++){
+  uint other = pick(type, need_indirect);
+  if (other != inum) {return other;}
+ }
+ return 0;
+}
+
+//Inject the corruption named c into a random victim
+//blocks orphaned by the change are freed in the bitmap so fcheck reports only the injected error
+//returns the victim inode, or the block for mrkused, 0 if the image has nothing to corrupt
+uint corrupt(const char *c){
+ uint inum, other;
+ struct dinode *ip;
+
+ if (strcmp(c, "badinode") == 0){
+  if ((inum = pick(T_FILE, false)) == 0) {return 0;}
+  INODE_ADDR(inum)->type = 7;
+ } else if (strcmp(c, "badaddr") == 0){
+  if ((inum = pick(T_FILE, false)) == 0) {return 0;}
+  ip = INODE_ADDR(inum);
+  set_bit(ip->addrs[0], false);
+  ip->addrs[0] = sb->size + random_below(1000);
+ } else if (strcmp(c, "badindir") == 0){
+  if ((inum = pick(T_FILE, true)) == 0) {return 0;}
+  uint *indirect = (uint *)(addr + INODE_ADDR(inum)->addrs[NDIRECT] * BLOCK_SIZE);
+  set_bit(indirect[0], false);
+  indirect[0] = sb->size + random_below(1000);
+ } else if (strcmp(c, "badroot") == 0){
+  inum = ROOTINO;
+  INODE_ADDR(inum)->size = 0;
+ } else if (strcmp(c, "badfmt") == 0){
+  if ((inum = pick(T_DIR, false)) == 0) {return 0;}
+  ip = INODE_ADDR(inum);
+  ((struct dirent *)(addr + ip->addrs[0] * BLOCK_SIZE))->inum = 0;				//"." is the first entry
+ } else if (strcmp(c, "mrkfree") == 0){
+  if ((inum = pick(T_FILE, false)) == 0) {return 0;}
+  set_bit(INODE_ADDR(inum)->addrs[0], false);
+ } else if (strcmp(c, "indirfree") == 0){
+  if ((inum = pick(T_FILE, true)) == 0) {return 0;}
+  set_bit(((uint *)(addr + INODE_ADDR(inum)->addrs[NDIRECT] * BLOCK_SIZE))[0], false);
+ } else if (strcmp(c, "mrkused") == 0){
+  if (freeblock >= sb->size) {return 0;}
+  inum = freeblock + random_below(sb->size - freeblock);
+  set_bit(inum, true);
+ } else if (strcmp(c, "addronce") == 0){
+  if ((inum = pick(T_FILE, false)) == 0 || (other = pick_other(inum, T_FILE, false)) == 0) {return 0;}
+  ip = INODE_ADDR(inum);
+  set_bit(ip->addrs[0], false);
+  ip->addrs[0] = INODE_ADDR(other)->addrs[0];
+ } else if (strcmp(c, "addronce2") == 0){
+  if ((inum = pick(T_FILE, true)) == 0 || (other = pick_other(inum, T_FILE, true)) == 0) {return 0;}
+  uint *indirect = (uint *)(addr + INODE_ADDR(inum)->addrs[NDIRECT] * BLOCK_SIZE);
+  set_bit(indirect[0], false);
+  indirect[0] = ((uint *)(addr + INODE_ADDR(other)->addrs[NDIRECT] * BLOCK_SIZE))[0];	//both uses are indirect, whichever comes first
+ } else if (strcmp(c, "imrkused") == 0){
+  if ((inum = pick(T_FILE, false)) == 0) {return 0;}
+  dir_entry(inum)->inum = 0;
+ } else if (strcmp(c, "imrkfree") == 0){
+  if ((inum = pick(T_FILE, false)) == 0) {return 0;}
+  ip = INODE_ADDR(inum);
+  free_blocks(ip);
+  memset(ip, 0, sizeof(*ip));
+ } else if (strcmp(c, "badrefcnt") == 0){
+  if ((inum = pick(T_FILE, false)) == 0) {return 0;}
+  INODE_ADDR(inum)->nlink++;
+ } else if (strcmp(c, "dironce") == 0){
+  if ((inum = pick(T_DIR, false)) == 0) {return 0;}
+  INODE_ADDR(inum)->nlink = 2;
+ } else if (strcmp(c, "mismatch") == 0){
+  if ((inum = pick(T_DIR, false)) == 0) {return 0;}
+  ip = INODE_ADDR(inum);
+  struct dirent *dotdot = (struct dirent *)(addr + ip->addrs[0] * BLOCK_SIZE) + 1;		//".." is the second entry
+  dotdot->inum = (parent[inum] == ROOTINO) ? inum : ROOTINO;
+ } else {
+  return 0;
+ }
+ return inum;
+}
+
+//Helper function to read a size in blocks, with an optional K, M or G suffix for bytes
+uint parse_size(const char *s){
+ char *end;
+ unsigned long long n = strtoull(s, &end, 10);
+ if (*end == 'K' || *end == 'k') {n = (n << 10) / BLOCK_SIZE;}
+ else if (*end == 'M' || *end == 'm') {n = (n << 20) / BLOCK_SIZE;}
+ else if (*end == 'G' || *end == 'g') {n = (n << 30) / BLOCK_SIZE;}
+ return (n > UINT32_MAX) ? 0 : n;
+}
+
+const char usage[] = "Usage: fsgen [-b block_size] [-s size] [-i inodes] [-d depth] [-f fanout] [-n files] [-m max_blocks] [-x indirect_pct]\n"
+                     "             [-S seed] [-c corruption] <file_system_image>\n";
+
+int
+main(int argc, char *argv[]){
+ struct options o = {1024, 200, 3, 2, 4, 8, 10, 1, NULL};					//defaults match xv6 mkfs
+ const char *size = NULL;
+ int opt, i;
+
+ while((opt = getopt(argc, argv, "b:s:i:d:f:n:m:x:S:c:")) != -1){				//parse options
+  switch(opt){
+  case 'b': bsize = atoi(optarg); break;
+  case 's': size = optarg; break;
+  case 'i': o.ninodes = atoi(optarg); break;
+  case 'd': o.depth = atoi(optarg); break;
+  case 'f': o.fanout = atoi(optarg); break;
+  case 'n': o.files = atoi(optarg); break;
+  case 'm': o.max_blocks = MIN(atoi(optarg), NDIRECT); break;
+  case 'x': o.indirect = atoi(optarg); break;
+  case 'S': o.seed = strtoull(optarg, NULL, 0); break;
+  case 'c': o.corrupt = optarg; break;
+  default: fprintf(stderr, "%s", usage); exit(1);
+  }
+ }
+ if(optind >= argc){
+  fprintf(stderr, "%s", usage);
+  exit(1);
+ }
+ if(bsize != 512 && bsize != 1024 && bsize != 4096){						//the block sizes fcheck has kernels for
+  fprintf(stderr, "fsgen: block size must be 512, 1024 or 4096.\n");
+  exit(1);
+ }
+ if(size != NULL) {o.size = parse_size(size);}							//byte sizes need the block size
+ if(o.corrupt != NULL){
+  for(i = 0; corruptions[i] != NULL && strcmp(corruptions[i], o.corrupt) != 0; i++);
+  if(corruptions[i] == NULL){
+   fprintf(stderr, "fsgen: corruption must be one of:");
+   for(i = 0; corruptions[i] != NULL; i++) {fprintf(stderr, " %s", corruptions[i]);}
+   fprintf(stderr, "\n");
+   exit(1);
+  }
+ }
+
+ o.ninodes = (o.ninodes + IPB - 1) / IPB * IPB;							//whole inode blocks, like fcheck counts them
+ if(o.ninodes < IPB || o.ninodes > MAXINODES || o.depth < 0 || o.fanout < 0 || o.files < 0 || o.max_blocks < 0){
+  fprintf(stderr, "fsgen: inodes must be %u to %d, the other counts at least 0.\n", (uint)IPB, MAXINODES);
+  exit(1);
+ }
+ uint bitblocks = (o.size + BPB - 1) / BPB;
+ datastart = o.ninodes / IPB + 3 + bitblocks;							//boot, super, inodes, bitmap
+ if(o.size <= datastart){
+  fprintf(stderr, "fsgen: size must be more than the %u metadata blocks.\n", datastart);
+  exit(1);
+ }
+
+ int fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0666);
+ if(fd < 0 || ftruncate(fd, (off_t)o.size * BLOCK_SIZE) != 0){					//sparse, only written blocks take space
+  perror(argv[optind]);
+  exit(1);
+ }
+ addr = mmap(NULL, (size_t)o.size * BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+ if(addr == MAP_FAILED){
+  perror("mmap");
+  exit(1);
+ }
+
+ sb = (struct superblock *)(addr + 1 * BLOCK_SIZE);
+ sb->size = o.size;
+ sb->nblocks = o.size - datastart;
+ sb->ninodes = o.ninodes;
+ parent = calloc(o.ninodes, sizeof(uint));
+ entry = calloc(o.ninodes, sizeof(uint));
+ rng = o.seed ? o.seed : 1;										//xorshift needs a nonzero state
+
+ for(freeblock = 0; freeblock < datastart; freeblock++){						//metadata blocks are always in use
+  set_bit(freeblock, true);
+ }
+ build(&o);
+
+ uint victim = 0;
+ if(o.corrupt != NULL && (victim = corrupt(o.corrupt)) == 0){
+  fprintf(stderr, "fsgen: image has nothing to inject %s into.\n", o.corrupt);
+  exit(1);
+ }
+
+ printf("%s: %u blocks (%u allocated), %u inodes, %u directories, %u files", argv[optind], o.size, freeblock, o.ninodes, ndirs, nfiles);
+ if(o.corrupt != NULL) {printf(", %s at %s %u", o.corrupt, strcmp(o.corrupt, "mrkused") == 0 ? "block" : "inode", victim);}
+ printf("\n");
+
+ if(msync(addr, (size_t)o.size * BLOCK_SIZE, MS_SYNC) != 0 || munmap(addr, (size_t)o.size * BLOCK_SIZE) != 0 || close(fd) != 0){
+  perror(argv[optind]);
+  exit(1);
+ }
+ exit(0);
+}
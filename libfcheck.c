@@ -0,0 +1,2093 @@
+#define _GNU_SOURCE		//O_DIRECT for FCHECK_IO_DIRECT
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "fcheck.h"
+#define dirent xv6_dirent  // avoid clash with host struct dirent
+#include "types.h"
+#include "fs.h"
+#undef dirent
+
+//The checks behind fcheck.h
+//all state lives in a struct fcheck, the first error (or every error with opts->all) is returned from fcheck_run
+
+//stat struct in stat.h was causing compile errors due to sharing a name with the stat structure used for fstat
+//definitions from stat.h are copied here to fix this
+#define T_DIR 1		//dir
+#define T_FILE 2	//file
+#define T_DEV 3		//device
+#define NDEV 10		//device major numbers run from 1 to NDEV - 1 (param.h)
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+//Geometry of the image, xv6 keeps NDIRECT and the 64 byte dinode for every block size
+//lg is the log2 of the block size, so every size and index below is a shift or a mask;
+//the hot kernels get lg as a constant and are compiled once per block size, the rest pass fc->lg
+#define LG_MIN 9										//512 byte blocks, the xv6 default
+#define LG_MAX 12										//4096 byte blocks
+#define LG_INODE 6										//log2 of sizeof(struct dinode)
+#define LG_DIRENT 4										//log2 of sizeof(struct xv6_dirent)
+#define GEO_BSIZE(lg) ((size_t)1 << (lg))							//block size
+#define GEO_IPB(lg) (1u << ((lg) - LG_INODE))							//inodes per block
+#define GEO_DPB(lg) (1u << ((lg) - LG_DIRENT))							//directory entries per block
+#define GEO_NINDIRECT(lg) (1u << ((lg) - 2))							//addresses in an indirect block
+#define GEO_BPB(lg) (1u << ((lg) + 3))								//bits in a bitmap block
+#define GEO_BMAPSTART(lg, ninodes) (((ninodes) >> ((lg) - LG_INODE)) + 3)			//first bitmap block, after boot block, superblock and inodes
+#define GEO_BBLOCK(lg, b, ninodes) ((b) / GEO_BPB(lg) + GEO_BMAPSTART(lg, ninodes))	//bitmap block holding the bit of block b
+#define BLOCK_ADDR(fc, lg, b) ((fc)->addr + (size_t)(b) * GEO_BSIZE(lg))			//start of block b in the image
+#define INODE_ADDR(fc, lg, i) ((struct dinode *)BLOCK_ADDR(fc, lg, ((size_t)(i) >> ((lg) - LG_INODE)) + 2) + ((i) & (GEO_IPB(lg) - 1)))	//translate inode number to its place in the inode table
+
+_Static_assert(sizeof(struct dinode) == 1 << LG_INODE, "inode size must match LG_INODE");
+_Static_assert(sizeof(struct xv6_dirent) == 1 << LG_DIRENT, "directory entry size must match LG_DIRENT");
+_Static_assert(FCHECK_NERRORS <= 32, "the scan and the walk keep some errors as bits of a uint");
+_Static_assert(DIRSIZ >= 8 && DIRSIZ <= 16, "a name is hashed as two overlapping 64 bit words");
+
+//Block sizes with a compiled set of kernels, as log2
+static const int geometries[] = {9, 10, 12};
+#define NGEOMETRIES ((int)(sizeof(geometries) / sizeof(geometries[0])))
+
+//Kernel compiled into each of its per block size callers, where lg is a constant
+#define KERNEL static inline __attribute__((always_inline))
+
+//Vectors of the scan kernels, GCC vector extensions in the 128 bit registers every target has
+//(SSE2 on x86-64, NEON on arm64); the kernels check VLANES inodes or addresses per call,
+//a few vectors at a time, and return one bit per inode or address
+#define VLANES 16										//inodes or addresses in one mask
+#define VWIDTH 4										//lanes of a vector
+typedef uint vec_uint __attribute__((vector_size(VWIDTH * sizeof(uint))));
+typedef int vec_int __attribute__((vector_size(VWIDTH * sizeof(int))));
+typedef float vec_float __attribute__((vector_size(VWIDTH * sizeof(float))));
+
+_Static_assert(NDIRECT + 1 <= VLANES, "every address of an inode must fit in one vector");
+_Static_assert(VLANES % VWIDTH == 0, "a mask must be a whole number of vectors");
+_Static_assert(GEO_NINDIRECT(9) % VLANES == 0, "an indirect block must be a whole number of vectors");
+
+//Packed map with one bit per block, for the checks that compare with the on-disk bitmap
+//which inode owns a block is kept in the reverse index, see claim_block()
+struct block_map {
+ uint nblocks;			//number of blocks covered by the map
+ uint64_t* used;		//bit set when a block is claimed
+};
+
+#define MAP_WORDS(n) (((n) + 63) / 64)							//64 bit words needed for n blocks
+
+//Entry of the reverse index, the owner of a block packed in 64 bits so it is claimed with one compare and swap
+//inode in the high 32 bits, logical block of the file in the next 16, then the role and the flags;
+//entries compare in scan order once shifted by 16, 0 means no owner
+#define OWNER(inum, offset, role) (((uint64_t)(inum) << 32) | ((uint64_t)(offset) << 16) | ((uint64_t)(role) << 8))
+#define OWNER_INUM(o) ((int)((o) >> 32))
+#define OWNER_OFFSET(o) ((int)((o) >> 16) & 0xffff)
+#define OWNER_ROLE(o) ((int)((o) >> 8) & 0xff)
+#define OWNER_ORDER(o) ((o) >> 16)
+#define OWNER_SHARED ((uint64_t)1)								//another address claims the block too
+
+#define PARENT_SHARED 0x80000000u								//a second directory names the directory too, see note_parent()
+#define PATH_SLOT 16										//bytes of path_names per inode, a name and its NUL fit
+#define LINK_BUSY ((uint64_t)1 << 63)								//a walker is copying the name of the link, see note_link()
+#define WALK_END UINT_MAX									//entry slot of a walk error about a whole directory, see walk_before()
+#define WALK_ON ((uint64_t)1 << 63)								//walk_order of a directory on the way to the kept error, with its entry below
+#define WALK_AFTER ((uint64_t)1 << 62)							//walk_order of a directory wholly after the kept error, for good
+#define WALK_BEFORE ((uint64_t)1 << 61)							//walk_order of a directory wholly before the kept error, with walk_gen below
+
+_Static_assert(DIRSIZ < PATH_SLOT, "a name and its NUL must fit a path slot");
+
+//test case number and message for each error
+static struct error_info {
+ int test;
+ const char* msg;
+} error_info[FCHECK_NERRORS] = {
+ [FCHECK_ERR_BAD_INODE]    = {1,  "ERROR: bad inode."},
+ [FCHECK_ERR_NO_ROOT]      = {3,  "ERROR: root directory does not exist."},
+ [FCHECK_ERR_BITMAP_FREE]  = {5,  "ERROR: address used by inode but marked free in bitmap."},
+ [FCHECK_ERR_REF_FREE]     = {10, "ERROR: inode referred to in directory but marked free."},
+ [FCHECK_ERR_DIR_FORMAT]   = {4,  "ERROR: directory not properly formatted."},
+ [FCHECK_ERR_NOT_IN_DIR]   = {9,  "ERROR: inode marked use but not found in a directory."},
+ [FCHECK_ERR_BAD_DIRECT]   = {2,  "ERROR: bad direct address in inode."},
+ [FCHECK_ERR_BAD_INDIRECT] = {2,  "ERROR: bad indirect address in inode."},
+ [FCHECK_ERR_BITMAP_USED]  = {6,  "ERROR: bitmap marks block in use but it is not in use."},
+ [FCHECK_ERR_DUP_DIRECT]   = {7,  "ERROR: direct address used more than once."},
+ [FCHECK_ERR_DUP_INDIRECT] = {8,  "ERROR: indirect address used more than once."},
+ [FCHECK_ERR_REFCOUNT]     = {11, "ERROR: bad reference count for file."},
+ [FCHECK_ERR_DIR_LINKS]    = {12, "ERROR: directory appears more than once in file system."},
+ [FCHECK_ERR_PARENT]       = {13, "ERROR: parent directory mismatch."},
+ [FCHECK_ERR_UNREACHABLE]  = {14, "ERROR: inaccessible directory exists."},
+ [FCHECK_ERR_SIZE_SHORT]   = {15, "ERROR: inode size needs more blocks than the inode has."},
+ [FCHECK_ERR_PAST_EOF]     = {15, "ERROR: block allocated past the end of file."},
+ [FCHECK_ERR_DEVICE]       = {16, "ERROR: bad device number."},
+ [FCHECK_ERR_DIR_SIZE]     = {17, "ERROR: directory size is not a multiple of the entry size."},
+ [FCHECK_ERR_DUP_NAME]     = {18, "ERROR: name appears more than once in a directory."},
+ [FCHECK_ERR_BAD_NAME]     = {19, "ERROR: malformed directory entry name."},
+ [FCHECK_ERR_NO_MEMORY]    = {0,  "ERROR: out of memory."},
+};
+
+//Growable list of recorded violations, kept in the context's arena
+struct error_list {
+ struct fcheck_result* errors;
+ int count;
+ int capacity;
+};
+
+static const char* io_names[FCHECK_NIO] = {
+ [FCHECK_IO_MMAP]   = "mmap",
+ [FCHECK_IO_PREAD]  = "pread",
+ [FCHECK_IO_DIRECT] = "direct",
+};
+
+#define IO_ALIGN 4096										//offset and length alignment for O_DIRECT
+#define IO_GAP 8										//unwanted blocks read through to join two runs
+
+//Bump allocator holding all per-image state of a context
+//the address space is reserved up front and only backed by memory when it is used,
+//so the arena never moves and is emptied in O(1) between images
+struct arena {
+ char* base;			//start of the reserved address space
+ size_t capacity;		//bytes reserved
+ size_t used;			//bytes handed out, bumped atomically by the scan and walk threads
+};
+
+#define ARENA_ALIGN 16										//alignment of every arena allocation
+#define ARENA_SLACK ((size_t)64 << 20)								//room reserved for lists that grow during a check
+
+//Summary of the inode table filled by the inode scan for inodes 0 to ninodes
+//one tightly typed column per field, so a check streams through only the columns it reads
+//instead of striding over 64 byte dinodes; bad inodes keep type 0 and nothing else
+//block addresses aren't summarised, the walk needs each address of a directory and reads its dinode
+struct inode_summary {
+ uchar* type;			//type, 0 for a free or bad inode
+ short* nlink;			//link count as stored, a corrupt inode can hold any value
+ uint* size;			//size in bytes
+};
+
+struct fcheck;
+
+//Slot of a walker's name set, see names_insert()
+struct name_slot {
+ uint stamp;			//directory the slot was filled for, the slot is empty for any other
+ const char* name;		//DIRSIZ bytes of the entry, in the image
+};
+
+//Work-stealing deque of directories for one directory walker
+//the owner pushes and takes at the tail, idle walkers steal from the head
+struct dir_deque {
+ struct fcheck* fc;		//check this walker belongs to
+ int id;			//index of this walker
+ pthread_mutex_t lock;		//guards the fields below
+ int* dirs;			//queued directory inodes
+ int head;			//oldest queued directory
+ int tail;			//one past the newest queued directory
+ int capacity;			//allocated size of dirs
+
+ //set of the names in the directory the walker is checking, only used by the owner (tests 18 and 19)
+ struct name_slot* names;	//open addressing table, nslots is a power of two
+ uint nslots;			//slots in names
+ uint stamp;			//stamp of the directory being checked, bumped to empty the set
+};
+
+//Work done by one thread of the inode scan
+//each shard covers the inodes [first, last) and keeps its own block ownership maps,
+//so threads never write to the same memory; shards are combined in merge_shards()
+struct scan_shard {
+ struct fcheck* fc;		//check this shard belongs to
+ int first;			//first inode of the range
+ int last;			//one past the last inode of the range
+ struct block_map block_used;	//blocks used by inodes in this range (test 6)
+ struct block_map alloc_used;	//blocks of allocated inodes in this range, must be marked in the bitmap
+ int fatal_error;		//first error that stops the scan, reported before all others
+ int fatal_inum;		//inode of fatal_error
+ int addr_error;		//first bad address error in this range (test 2)
+ int addr_inum;			//inode of that address
+ uint addr_block;		//the address
+ uint inode_errors;		//bit 1 << err for each error of tests 15 to 17 found in this range
+ int inode_error_inum[FCHECK_NERRORS];	//first inode with each error of inode_errors
+ uint64_t first_dup;		//first repeated claim this shard found, its own or one it displaced, 0 if none (test 7/8)
+ uint first_dup_block;		//block of first_dup
+ struct error_list errors;	//every error found in this range with --all
+};
+
+//Checks that run after the inode scan, in the order their errors are reported
+enum check_task {
+ TASK_WALK,			//directory walk (tests 3, 4 and 10)
+ TASK_TEST9,
+ TASK_TEST2,
+ TASK_TEST6,
+ TASK_TEST78,
+ TASK_TEST11,
+ TASK_TEST12,
+ TASK_TEST13,
+ TASK_TEST14,
+ TASK_TEST15,
+ TASK_TEST16,
+ TASK_TEST17,
+ TASK_TEST18,
+ TASK_TEST19,
+ NTASKS
+};
+
+//Inputs the scheduled checks read, each produced by the scan or by another check
+#define INPUT_SUMMARY 1										//inode types, link counts and allocated inodes (scan)
+#define INPUT_BLOCKS 2										//block ownership maps and address errors (scan)
+#define INPUT_LINKS 4										//directory references to every inode (walk)
+
+enum task_status {TASK_PENDING, TASK_RUNNING, TASK_DONE};
+
+//Progress of one scheduled check for the image being checked
+struct task_state {
+ int status;			//enum task_status
+ struct fcheck_result first;	//first error the check found, err is FCHECK_ERR_NONE if it passed
+};
+
+//State for checking one image
+//a context can check many images one after the other, everything an image needs comes from its arena
+struct fcheck {
+ int nthreads;			//number of threads used for the inode scan and directory walk (-j)
+ bool all_mode;			//record every error instead of stopping at the first one (--all)
+ size_t mem_limit;		//most bytes the arena may reserve, 0 for no limit (--max-mem)
+ int io;			//enum fcheck_io, how the image is read (--io)
+ int block_size;		//block size given by the caller, 0 to detect it (--bsize)
+ struct arena arena;		//per-image memory, emptied by fcheck_reset()
+ fcheck_callback on_error;	//called for every error at the end of fcheck_run, may be NULL
+ void* arg;			//passed to on_error
+ jmp_buf bail;			//where fail() jumps to end the check, set by fcheck_run
+ int result;			//error that made fail() jump to bail
+ struct fcheck_result first;	//the only result of a check that stopped early, kept outside the arena
+ int out_of_memory;		//a scan or walk thread could not allocate, checked once the threads are done
+
+ int fsfd;			//used to open image file
+ bool owns_fd;			//fsfd was opened by fcheck_open and is closed with the image
+ bool owns_map;			//addr was mapped by the context and is unmapped with the image
+ char* addr;			//used to access image file, mapped or read into memory by the backend
+ size_t image_size;		//size of the mapping
+ struct superblock *sb;		//super block of the image
+ int lg;			//log2 of the block size of the image
+
+ struct inode_summary inodes;	//columns of the inode table, saved by the inode scan
+ ushort* active_inode_list;	//1 for an allocated inode plus 1 per directory entry naming it, 0 if free, saturates
+ uint64_t* dir_visited;		//bit set once a directory is queued for the walk
+ uint* parent;			//lowest directory with an entry naming each directory, 0 if none (tests 13 and 14)
+ uint* dotdot;			//inode the ".." entry of each walked directory names, 0 if none (test 13)
+
+ //path table for reports, only with opts->paths, see note_link() and intern_paths()
+ bool want_paths;		//record a path for every inode in the walk
+ uint64_t* path_links;		//per inode, directory << 32 | entry position naming it, 0 if none; directory << 32 | name offset once interned
+ char* path_names;		//per inode, PATH_SLOT bytes holding the name of its link; every name once once interned
+ bool paths_ready;		//path_links holds name offsets, fcheck_path can answer
+
+ //results of the single inode table scan, reported later by the test functions
+ struct block_map block_used;	//blocks used by inodes or metadata (test 6)
+ uint64_t* owners;		//reverse index, owner of every block up to sb->size, see claim_block()
+ bool owners_complete;		//every inode was scanned, so the index can answer fcheck_who_owns
+ int addr_error;		//first bad address error found in the scan (test 2)
+ int addr_inum;			//inode of that address
+ long addr_block;		//the address
+ uint inode_errors;		//bit 1 << err for each error of tests 15 to 17 found in the scan
+ int dup_error;			//first repeated address error found in the scan (test 7/8)
+ int dup_inum;			//inode of that address
+ long dup_block;		//block it repeats
+ struct scan_shard* shards;	//one shard per scan thread
+
+ struct dir_deque* walk_deques;	//one deque per directory walker
+ int nwalkers;			//number of directory walkers
+ int walk_pending;		//directories queued or being checked, the walk ends when it reaches 0
+ int walk_error;		//first error found by the directory walk, in the order of a recursive walk
+ uint walk_error_dir;		//directory the error was found in, its entry is in walk_order
+ int walk_error_inum;		//inode the error is about
+ char walk_error_name[DIRSIZ];	//name of its entry as in the entry, empty for the directory as a whole
+ uint64_t* walk_from;		//per queued directory, directory << 32 | entry that queued it, 0 for the root
+ uint64_t* walk_order;		//per queued directory, where it lies from the kept error, see walk_before()
+ uint walk_gen;			//bumped when the kept error moves, a WALK_BEFORE with an older one is stale
+ uint name_errors;		//bit 1 << err for each error of tests 18 and 19 found by the walk
+ uint64_t name_error_at[FCHECK_NERRORS];	//directory << 32 | entry of the first of each, see name_error()
+ struct fcheck_result flagged[FCHECK_NERRORS];	//first error of each kind of tests 15 to 19, reported by flag_error()
+
+ struct error_list errors;	//errors recorded in --all mode
+ pthread_mutex_t errors_lock;	//guards errors for the directory walkers
+
+ //check scheduler, see fcheck_schedule()
+ struct task_state tasks[NTASKS];	//progress of every scheduled check
+ int inputs;			//inputs produced so far
+ int first_failed;		//first task in report order that found an error, NTASKS if none yet
+ bool helper_started;		//the helper thread is running and must be joined
+ bool helper_stop;		//tells the helper thread to exit
+ pthread_t helper;		//runs scheduled checks next to the calling thread with -j
+ pthread_mutex_t tasks_lock;	//guards the scheduler fields above
+ pthread_cond_t tasks_changed;	//signalled when a task finishes or the helper should exit
+};
+
+//Reserve at least size bytes of address space for an arena and empty it
+//pages are only backed by memory once they are written, an arena that is big enough is kept
+//returns false if the address space can't be reserved
+static bool arena_reserve(struct arena *a, size_t size){
+ size = (size + 4095) & ~(size_t)4095;
+ if (size > a->capacity){
+  if (a->base != NULL) {munmap(a->base, a->capacity);}
+  a->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (a->base == MAP_FAILED){
+   memset(a, 0, sizeof(*a));
+   return false;
+  }
+  a->capacity = size;
+ }
+ a->used = 0;
+ return true;
+}
+
+static void arena_free(struct arena *a){
+ if (a->base != NULL) {munmap(a->base, a->capacity);}
+ memset(a, 0, sizeof(*a));
+}
+
+//Take n zeroed bytes from an arena, safe to call from several threads
+//returns NULL if the arena is full, which only happens when --max-mem is too small for the image
+static void* arena_alloc(struct arena *a, size_t n){
+ n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+ size_t off = __atomic_fetch_add(&a->used, n, __ATOMIC_RELAXED);
+ if (off + n > a->capacity){
+  return NULL;
+ }
+ memset(a->base + off, 0, n);									//memory is reused between images
+ return a->base + off;
+}
+
+//Helper function to fill in a result
+//name may be NULL, it is copied without reading past DIRSIZ
+static void result_set(struct fcheck_result *e, int err, int inum, long block, const char *name){
+ e->err = err;
+ e->inum = inum;
+ e->block = block;
+ memset(e->name, 0, sizeof(e->name));
+ if (name != NULL) {strncpy(e->name, name, DIRSIZ);}
+}
+
+//Add an error to a list, moving it to a bigger block of the arena when full
+//returns false if the arena is full, the error is then dropped
+static bool error_add(struct arena *a, struct error_list *l, int err, int inum, long block, const char *name){
+ if (l->count == l->capacity){
+  struct fcheck_result *errors = (struct fcheck_result *)arena_alloc(a, (l->capacity ? l->capacity * 2 : 16) * sizeof(struct fcheck_result));
+  if (errors == NULL) {return false;}
+  if (l->count > 0) {memcpy(errors, l->errors, l->count * sizeof(struct fcheck_result));}
+  l->errors = errors;
+  l->capacity = l->capacity ? l->capacity * 2 : 16;
+ }
+ result_set(&l->errors[l->count++], err, inum, block, name);
+ return true;
+}
+
+//Helper function for the scan and walk threads to add an error to their own list
+//running out of memory is noted for the thread that runs the check
+static void thread_error_add(struct fcheck *fc, struct error_list *l, int err, int inum, long block, const char *name){
+ if (!error_add(&fc->arena, l, err, inum, block, name)){
+  __atomic_store_n(&fc->out_of_memory, 1, __ATOMIC_RELAXED);
+ }
+}
+
+//Report an error found by a check
+//by default the error becomes the only result and the check jumps back to fcheck_run,
+//with --all the error is added to the context's list and the check carries on
+//running out of memory always ends the check
+//only the thread that called fcheck_run may end the check, the walkers only call this with --all
+static void fail(struct fcheck *fc, int err, int inum, long block, const char *name){
+ if (fc->all_mode && err != FCHECK_ERR_NO_MEMORY){
+  pthread_mutex_lock(&fc->errors_lock);
+  thread_error_add(fc, &fc->errors, err, inum, block, name);
+  pthread_mutex_unlock(&fc->errors_lock);
+  return;
+ }
+ result_set(&fc->first, err, inum, block, name);
+ fc->errors.errors = &fc->first;
+ fc->errors.count = 1;
+ fc->errors.capacity = 1;
+ fc->result = err;
+ longjmp(fc->bail, 1);
+}
+
+//Take n zeroed bytes from the context's arena for the thread running the check
+//ends the check if the arena is full
+static void* fcheck_alloc(struct fcheck *fc, size_t n){
+ void *p = arena_alloc(&fc->arena, n);
+ if (p == NULL) {fail(fc, FCHECK_ERR_NO_MEMORY, -1, -1, NULL);}
+ return p;
+}
+
+//qsort comparator ordering errors like the default checks report them, then by inode and block
+static int compare_errors(const void *a, const void *b){
+ const struct fcheck_result *x = a, *y = b;
+ if (x->err != y->err) {return x->err - y->err;}
+ if (x->inum != y->inum) {return x->inum - y->inum;}
+ if (x->block != y->block) {return (x->block < y->block) ? -1 : 1;}
+ return strncmp(x->name, y->name, DIRSIZ);
+}
+
+//Bit k of the result is set when lane k of a comparison is true
+KERNEL uint lane_mask(vec_int v){
+#ifdef __SSE2__
+ return __builtin_ia32_movmskps((vec_float)v);						//sign bit of each lane
+#else
+ uint mask = 0;
+ for (int k = 0; k < VWIDTH; k++) {mask |= (uint)(v[k] & 1) << k;}
+ return mask;
+#endif
+}
+
+//Function for test case 1, on VLANES inodes at once
+//an inode must have a valid type (1 to 3), or type 0 and size 0 if it's unallocated
+//returns a mask of the inodes first to first + n - 1 that are bad, bit 0 for first
+KERNEL uint invalid_inodes(struct fcheck *fc, int lg, int first, int n){
+ uint mask = 0;
+ for (int g = 0; g < n; g += VWIDTH){
+  vec_int type = {0}, size = {0};								//lanes past n hold a free inode
+  for (int k = 0; k < VWIDTH && g + k < n; k++){
+   struct dinode *ip = INODE_ADDR(fc, lg, first + g + k);
+   type[k] = (ushort)ip->type;									//a negative type wraps past 3
+   size[k] = ip->size;
+  }
+  mask |= lane_mask((type > 3) | ((type == 0) & (size != 0))) << g;
+ }
+ return mask;
+}
+
+//Range check of VLANES block addresses at once (test 2)
+//a block is outside the data blocks when block - start >= size - start, compared unsigned;
+//the sign bit is flipped on both sides so the signed compare SSE2 has gives the same answer;
+//a superblock with more data blocks than blocks has no good address, its limit is 0
+//returns a mask of the addresses holding a block, and in bad the ones outside the data blocks
+KERNEL uint address_lanes(const uint *addrs, uint start, uint size, uint *bad){
+ vec_int limit = {0};
+ limit += (int)(((start <= size) ? size - start : 0) ^ 0x80000000u);
+ uint used = 0, out = 0;
+ for (int g = 0; g < VLANES; g += VWIDTH){
+  vec_uint v;
+  memcpy(&v, addrs + g, sizeof(v));								//addresses in an image need not be aligned
+  vec_int nonzero = v != 0;
+  used |= lane_mask(nonzero) << g;
+  out |= lane_mask(nonzero & ((vec_int)((v - start) ^ 0x80000000u) >= limit)) << g;
+ }
+ *bad = out;
+ return used;
+}
+
+// Function to read the value for block in the bitmap
+// returns  and integer 1/0 (allocated/not allocated)
+// bits that would lie past the end of the image read as 0
+KERNEL int get_bit(struct fcheck *fc, int lg, uint block_number) {
+	size_t bitmap_block = GEO_BBLOCK(lg, block_number, fc->sb->ninodes);
+	unsigned char *bitmap = (unsigned char *)BLOCK_ADDR(fc, lg, bitmap_block);
+	uint bit = block_number % GEO_BPB(lg);							// bit of the block within its bitmap block
+	if (bitmap_block * GEO_BSIZE(lg) + bit / 8 >= fc->image_size) {return 0;}
+	// Get the byte and check the bit corresponding to the block
+	return (bitmap[bit / 8] >> (bit % 8)) & 1;
+}
+
+//Set up an empty block map for nblocks blocks in an arena
+//returns false if the arena is full
+static bool block_map_init(struct arena *a, struct block_map *m, uint nblocks){
+ m->nblocks = nblocks;
+ m->used = (uint64_t *)arena_alloc(a, MAP_WORDS(nblocks) * sizeof(uint64_t));
+ return m->used != NULL;
+}
+
+//Set up an empty block map for the thread running the check, ends the check if the arena is full
+static void fcheck_map(struct fcheck *fc, struct block_map *m, uint nblocks){
+ if (!block_map_init(&fc->arena, m, nblocks)) {fail(fc, FCHECK_ERR_NO_MEMORY, -1, -1, NULL);}
+}
+
+// returns 1 if block b is claimed in the map
+static int block_map_test(struct block_map *m, uint b){
+ return (m->used[b / 64] >> (b % 64)) & 1;
+}
+
+//Claim block b in the map
+static void block_map_set(struct block_map *m, uint b){
+ m->used[b / 64] |= (uint64_t)1 << (b % 64);
+}
+
+//Add the blocks claimed in src to dst
+static void block_map_merge(struct block_map *dst, struct block_map *src){
+ uint w;
+ for (w = 0; w < MAP_WORDS(MIN(dst->nblocks, src->nblocks)); w++){
+  dst->used[w] |= src->used[w];
+ }
+}
+
+//Compare map m with the on-disk bitmap, one bitmap block after the other and 64 blocks at a time
+//so a bitmap spanning many blocks is read once, front to back
+//in_map selects which disagreement to look for: blocks claimed in m but free on disk,
+//or blocks marked in use on disk but not claimed in m
+//bitmap bytes past the end of the image read as 0, like get_bit()
+//returns the first such block number from block from on, or -1 if the two agree
+static long bitmap_mismatch(struct fcheck *fc, struct block_map *m, bool in_map, uint from){
+ int lg = fc->lg;
+ uint words_per_block = GEO_BPB(lg) / 64;
+ uint nwords = MAP_WORDS(m->nblocks);
+ uint w = from / 64;
+
+ for (uint b = w / words_per_block; w < nwords; b++){
+  size_t start = (size_t)(GEO_BMAPSTART(lg, fc->sb->ninodes) + b) << lg;			//bitmap block b covers words_per_block words of m
+  unsigned char *bitmap = (unsigned char *)fc->addr + start;
+  size_t avail = (start < fc->image_size) ? MIN(fc->image_size - start, GEO_BSIZE(lg)) : 0;
+  uint end = MIN(nwords, (b + 1) * words_per_block);
+
+  for (; w < end; w++){
+   uint64_t disk = 0;
+   size_t off = (size_t)(w % words_per_block) * sizeof(uint64_t);
+   if (off < avail){
+    memcpy(&disk, bitmap + off, MIN(avail - off, sizeof(uint64_t)));			//bitmap bytes are little endian, like the host
+   }
+   uint64_t diff = in_map ? (m->used[w] & ~disk) : (disk & ~m->used[w]);
+   if (w == nwords - 1 && m->nblocks % 64 != 0){
+    diff &= ((uint64_t)1 << (m->nblocks % 64)) - 1;						//ignore bits past the last block
+   }
+   if (w == from / 64){
+    diff &= ~(uint64_t)0 << (from % 64);							//ignore bits before from
+   }
+   if (diff != 0){
+    return (long)w * 64 + __builtin_ctzll(diff);						//lowest mismatched block in this word
+   }
+  }
+ }
+ return -1;
+}
+
+//Check if entry slot of directory dir comes before the kept walk error, in a walk that recurses into
+//each directory at the entry that queued it, like the serial walk of the baseline; an entry comes
+//before everything found below the directory it names, and WALK_END after every entry
+//the directories on the way from the kept error to the root carry their entry on that way, and every
+//directory climbed through to reach one of them is marked wholly before or after, so each directory
+//is climbed through once per kept error and an entry costs O(1). Called with errors_lock held
+static bool walk_before(struct fcheck *fc, uint dir, uint slot){
+ uint x = dir, s = slot;
+ uint64_t v;
+ while (v = fc->walk_order[x], (v & WALK_ON) == 0 && v != WALK_AFTER && v != (WALK_BEFORE | fc->walk_gen)){
+  s = (uint)fc->walk_from[x];									//the root is always on the way, the climb ends there
+  x = fc->walk_from[x] >> 32;
+ }
+ bool before = (v & WALK_ON) ? (s < (uint)v || (s == (uint)v && x != fc->walk_error_dir)) : v != WALK_AFTER;
+ for (uint y = dir; y != x; y = fc->walk_from[y] >> 32){
+  fc->walk_order[y] = before ? (WALK_BEFORE | fc->walk_gen) : WALK_AFTER;
+ }
+ return before;
+}
+
+//Make entry slot of directory dir the kept walk error, it comes before the one kept so far unless first
+//the new way to the root is marked up to where it meets the old one; the directories left on the old
+//way are after the new error, and the kept error only ever moves earlier, so they stay after for good
+//and no directory is marked twice. Called with errors_lock held
+static void walk_keep(struct fcheck *fc, int err, int inum, uint dir, uint slot, const char *name, bool first){
+ uint x = dir, s = slot;
+ while (x != ROOTINO && (first || (fc->walk_order[x] & WALK_ON) == 0)){
+  fc->walk_order[x] = WALK_ON | s;
+  s = (uint)fc->walk_from[x];
+  x = fc->walk_from[x] >> 32;
+ }
+ if (!first){
+  for (uint y = fc->walk_error_dir; y != x; y = fc->walk_from[y] >> 32) {fc->walk_order[y] = WALK_AFTER;}
+ }
+ fc->walk_order[x] = WALK_ON | s;								//the directory where both ways meet, or the root
+ fc->walk_gen++;
+ fc->walk_error_dir = dir;
+ fc->walk_error_inum = inum;
+ memset(fc->walk_error_name, 0, sizeof(fc->walk_error_name));
+ if (name != NULL) {memcpy(fc->walk_error_name, name, strnlen(name, DIRSIZ));}
+ __atomic_store_n(&fc->walk_error, err, __ATOMIC_RELAXED);
+}
+
+//Helper function to record an error found by the directory walk at entry slot of directory dir
+//only the error a serial walk would find first is kept, whichever walker finds it or in which order,
+//so the walk goes on until nothing before the kept error is left, see walk_pruned();
+//with --all the error is recorded and the walk goes on
+static void walk_fail(struct fcheck *fc, int err, int inum, uint dir, uint slot, const char *name){
+ if (fc->all_mode){
+  fail(fc, err, inum, -1, name);
+  return;
+ }
+ pthread_mutex_lock(&fc->errors_lock);
+ int kept = __atomic_load_n(&fc->walk_error, __ATOMIC_RELAXED);
+ if (kept == FCHECK_ERR_NONE || (kept != FCHECK_ERR_NO_MEMORY && walk_before(fc, dir, slot))){
+  walk_keep(fc, err, inum, dir, slot, name, kept == FCHECK_ERR_NONE);
+ }
+ pthread_mutex_unlock(&fc->errors_lock);
+}
+
+//Check if the walk can skip everything after entry slot of directory dir, and below it
+//true once the kept error comes before it, or memory ran out
+static bool walk_pruned_slow(struct fcheck *fc, uint dir, uint slot){
+ if (__atomic_load_n(&fc->out_of_memory, __ATOMIC_RELAXED)) {return true;}
+ pthread_mutex_lock(&fc->errors_lock);
+ bool pruned = __atomic_load_n(&fc->walk_error, __ATOMIC_RELAXED) == FCHECK_ERR_NO_MEMORY || !walk_before(fc, dir, slot);
+ pthread_mutex_unlock(&fc->errors_lock);
+ return pruned;
+}
+
+KERNEL bool walk_pruned(struct fcheck *fc, uint dir, uint slot){
+ return __atomic_load_n(&fc->walk_error, __ATOMIC_RELAXED) != FCHECK_ERR_NONE && walk_pruned_slow(fc, dir, slot);
+}
+
+//Add a directory to the tail of a deque, moving it to a bigger block of the arena when full
+//if the arena is full the directory is dropped and the walk stops
+static void deque_push(struct dir_deque *q, int inum){
+ struct fcheck *fc = q->fc;
+ pthread_mutex_lock(&q->lock);
+ if (q->tail == q->capacity){
+  if (q->head > 0){										//reuse the space left by stolen entries
+   memmove(q->dirs, q->dirs + q->head, (q->tail - q->head) * sizeof(int));
+   q->tail -= q->head;
+   q->head = 0;
+  } else {
+   int *dirs = (int *)arena_alloc(&fc->arena, (q->capacity ? q->capacity * 2 : 64) * sizeof(int));
+   if (dirs == NULL){
+    int none = FCHECK_ERR_NONE;
+    __atomic_store_n(&fc->out_of_memory, 1, __ATOMIC_RELAXED);
+    __atomic_compare_exchange_n(&fc->walk_error, &none, FCHECK_ERR_NO_MEMORY, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&q->lock);
+    return;
+   }
+   if (q->tail > 0) {memcpy(dirs, q->dirs, q->tail * sizeof(int));}
+   q->dirs = dirs;
+   q->capacity = q->capacity ? q->capacity * 2 : 64;
+  }
+ }
+ __atomic_add_fetch(&fc->walk_pending, 1, __ATOMIC_SEQ_CST);					//counted before it can be taken
+ q->dirs[q->tail++] = inum;
+ pthread_mutex_unlock(&q->lock);
+}
+
+//Take a directory from a deque, the owner takes the newest one and thieves the oldest
+//returns false if the deque is empty
+static bool deque_take(struct dir_deque *q, bool steal, int *inum){
+ bool found = false;
+ pthread_mutex_lock(&q->lock);
+ if (q->head < q->tail){
+  *inum = steal ? q->dirs[q->head++] : q->dirs[--q->tail];
+  found = true;
+ }
+ if (q->head == q->tail){
+  q->head = q->tail = 0;
+ }
+ pthread_mutex_unlock(&q->lock);
+ return found;
+}
+
+//Count a directory entry naming an allocated inode
+//walkers may count the same inode at once; the count stops at USHRT_MAX instead of wrapping to free,
+//such a count is already more than any link count test 11 compares it with
+//returns false if the inode is free
+static bool add_reference(struct fcheck *fc, uint inum){
+ ushort *count = &fc->active_inode_list[inum];
+ ushort old = __atomic_load_n(count, __ATOMIC_RELAXED);
+ do {
+  if (old == 0) {return false;}
+  if (old == USHRT_MAX) {return true;}
+ } while (!__atomic_compare_exchange_n(count, &old, old + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+ return true;
+}
+
+//Note that directory dir has an entry naming the directory child
+//the parent kept is the lowest naming directory, so it doesn't depend on which walker got there first;
+//a second name, in another directory or the same one, sets PARENT_SHARED
+static void note_parent(struct fcheck *fc, uint child, uint dir){
+ uint *p = &fc->parent[child];
+ uint old = __atomic_load_n(p, __ATOMIC_RELAXED), next;
+ do {
+  next = (old == 0) ? dir : (MIN(old & ~PARENT_SHARED, dir) | PARENT_SHARED);
+ } while (!__atomic_compare_exchange_n(p, &old, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+//Note that entry pos of directory dir names inode inum, for the path table
+//the link kept is the lowest directory and in it the first entry, so it doesn't depend on which
+//walker got there first; "." and ".." aren't links and the root has no name
+//the name is copied from the entry the walk holds, LINK_BUSY keeps a link and its name together
+//when walkers race on an inode with several names
+static void note_link(struct fcheck *fc, uint inum, uint dir, uint pos, const char *name){
+ if (inum == ROOTINO || inum > fc->sb->ninodes || strncmp(name, ".", DIRSIZ) == 0 || strncmp(name, "..", DIRSIZ) == 0) {return;}
+ uint64_t *p = &fc->path_links[inum];
+ uint64_t link = (uint64_t)dir << 32 | pos;
+ uint64_t old = __atomic_load_n(p, __ATOMIC_ACQUIRE);
+ while (true){
+  if (old & LINK_BUSY){
+   old = __atomic_load_n(p, __ATOMIC_ACQUIRE);
+   continue;
+  }
+  if (old != 0 && link >= old) {return;}
+  if (__atomic_compare_exchange_n(p, &old, link | LINK_BUSY, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {break;}
+ }
+ char *slot = fc->path_names + (size_t)inum * PATH_SLOT;
+ memset(slot, 0, PATH_SLOT);
+ memcpy(slot, name, strnlen(name, DIRSIZ));
+ __atomic_store_n(p, link, __ATOMIC_RELEASE);
+}
+
+//Hash of a directory entry name field, as two overlapping 64 bit words
+KERNEL uint64_t name_hash(const char *name){
+ uint64_t lo, hi;
+ memcpy(&lo, name, 8);
+ memcpy(&hi, name + DIRSIZ - 8, 8);
+ return (lo ^ (hi * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+}
+
+//Empty a walker's name set for a directory of up to entries entries
+//the set grows to stay at most half full; its slots are reused for every directory the walker
+//checks and emptied by a new stamp, so a directory costs time for its own entries only
+//returns false if the arena is full, the walk then stops
+static bool names_reset(struct dir_deque *q, uint entries){
+ struct fcheck *fc = q->fc;
+ if (entries * 2 > q->nslots){
+  uint n = q->nslots ? q->nslots : 64;
+  while (n < entries * 2) {n *= 2;}
+  struct name_slot *names = (struct name_slot *)arena_alloc(&fc->arena, n * sizeof(struct name_slot));
+  if (names == NULL){
+   int none = FCHECK_ERR_NONE;
+   __atomic_store_n(&fc->out_of_memory, 1, __ATOMIC_RELAXED);
+   __atomic_compare_exchange_n(&fc->walk_error, &none, FCHECK_ERR_NO_MEMORY, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+   return false;
+  }
+  q->names = names;										//zeroed slots are empty, stamps start over
+  q->nslots = n;
+  q->stamp = 0;
+ }
+ q->stamp++;
+ return true;
+}
+
+//Add a name to the name set of the walker's directory
+//the fixed DIRSIZ byte field is hashed whole, as two overlapping 64 bit words, and compared whole;
+//only well formed names go in, their bytes after the end are all 0
+//returns true if the directory already has the name
+KERNEL bool names_insert(struct dir_deque *q, const char *name){
+ uint64_t h = name_hash(name);
+ uint mask = q->nslots - 1;
+ for (uint i = (uint)(h >> 32) & mask; ; i = (i + 1) & mask){
+  struct name_slot *slot = &q->names[i];
+  if (slot->stamp != q->stamp){
+   slot->stamp = q->stamp;
+   slot->name = name;
+   return false;
+  }
+  if (memcmp(slot->name, name, DIRSIZ) == 0) {return true;}
+ }
+}
+
+//Check that a directory entry name is well formed
+//a name can't be empty and xv6 fills the rest of the field with 0 (strncpy in dirlink and mkfs);
+//a name using all DIRSIZ bytes has no terminator, which xv6 allows
+KERNEL bool name_valid(const char *name){
+ size_t len = strnlen(name, DIRSIZ);
+ if (len == 0) {return false;}
+ for (size_t k = len; k < DIRSIZ; k++){
+  if (name[k] != '\0') {return false;}
+ }
+ return true;
+}
+
+//Helper function for the walk to record an error of tests 18 and 19 at entry pos of directory dir_inum
+//the walk goes on, these errors come after every other error; the one kept of each kind is in the
+//lowest directory and in it the first entry, so it doesn't depend on which walker got there first
+static void name_error(struct fcheck *fc, int err, int dir_inum, uint pos, const char *name){
+ if (fc->all_mode){
+  fail(fc, err, dir_inum, -1, name);
+  return;
+ }
+ uint64_t at = (uint64_t)dir_inum << 32 | pos;
+ pthread_mutex_lock(&fc->errors_lock);
+ if ((fc->name_errors & (1u << err)) == 0 || at < fc->name_error_at[err]){
+  fc->name_error_at[err] = at;
+  result_set(&fc->flagged[err], err, dir_inum, -1, name);
+ }
+ __atomic_fetch_or(&fc->name_errors, 1u << err, __ATOMIC_RELAXED);
+ pthread_mutex_unlock(&fc->errors_lock);
+}
+
+//Helper function for processing directore entries (dirents)
+//Checks if the inode is marked free
+//Checks if the dirent is a properly formatted directory
+//Subdirectories are pushed on the deque of the calling walker
+//pos is the place of the entry in the directory, for the path table
+static void process_dirent(struct dir_deque *q, struct xv6_dirent *de, int dir_inum, uint pos, bool* found_parent, bool* found_self){
+ struct fcheck *fc = q->fc;
+
+ // Skip empty entries, directories are queued for the walk below
+ if (de->inum != 0) {
+
+ //names must be well formed and unique, dirlookup() would never find an entry
+ //whose name an earlier entry of the directory has
+ if (!name_valid(de->name)){
+  name_error(fc, FCHECK_ERR_BAD_NAME, dir_inum, pos, de->name);
+ } else if (names_insert(q, de->name)){
+  name_error(fc, FCHECK_ERR_DUP_NAME, dir_inum, pos, de->name);
+ }
+
+ if (fc->path_links != NULL) {note_link(fc, de->inum, dir_inum, pos, de->name);}
+
+ //check if inode was allocated when we looped through the inodes
+ //an inode number past the inode table can't be allocated
+ if (de->inum > fc->sb->ninodes || !add_reference(fc, de->inum)){
+  walk_fail(fc, FCHECK_ERR_REF_FREE, de->inum, dir_inum, pos, de->name);
+  return;
+ }
+
+ //Skip "." and ".." directory entries and note that we found them
+ if (strncmp(de->name, ".", DIRSIZ) == 0){
+ if (de->inum != dir_inum){
+  walk_fail(fc, FCHECK_ERR_DIR_FORMAT, dir_inum, dir_inum, pos, de->name);
+ }
+  *found_self = true;
+  return;
+ } else if (strncmp(de->name, "..", DIRSIZ) == 0) {
+ *found_parent = true;
+ __atomic_store_n(&fc->dotdot[dir_inum], de->inum, __ATOMIC_RELAXED);				//atomic, the root is walked again if a directory names it
+ //If we're curretnly in the root dir, check that .. is the root dir still
+ if (dir_inum == ROOTINO && de->inum != dir_inum){
+  walk_fail(fc, FCHECK_ERR_NO_ROOT, dir_inum, dir_inum, pos, de->name);
+ }
+  return;
+}
+
+  // If it's a directory, queue it only once per directory inode
+  // setting its bit claims it so no two walkers check the same directory
+  if (fc->inodes.type[de->inum] == T_DIR) {
+  	note_parent(fc, de->inum, dir_inum);
+  	uint64_t bit = (uint64_t)1 << (de->inum % 64);
+  	if ((__atomic_fetch_or(&fc->dir_visited[de->inum / 64], bit, __ATOMIC_RELAXED) & bit) == 0) {
+  		if (de->inum != ROOTINO) {							//the root stays the top of the walk's tree
+  			fc->walk_from[de->inum] = (uint64_t)dir_inum << 32 | pos;
+  		}
+  		deque_push(q, de->inum);
+  	}
+  }
+ }
+}
+
+//Helper function to check the entries of a single directory
+//subdirectories found in it are pushed by process_dirent
+//blocks outside the image are skipped, test 2 reports them
+KERNEL void check_directory(struct dir_deque *q, int dir_inum, int lg) {
+	struct fcheck *fc = q->fc;
+
+	if (fc->inodes.type[dir_inum] != T_DIR || walk_pruned(fc, dir_inum, 0)) {return;}
+
+	struct dinode *dip = INODE_ADDR(fc, lg, dir_inum);
+	bool found_parent = false;
+	bool found_self = false;
+	int remaining = fc->inodes.size[dir_inum];
+
+	uint most = (NDIRECT + GEO_NINDIRECT(lg)) * GEO_DPB(lg);				//entries the largest directory holds
+	if (!names_reset(q, MIN((uint)remaining / sizeof(struct xv6_dirent), most))) {return;}
+
+	/* ---------- Direct blocks ---------- */
+	for (int b = 0; b < NDIRECT && remaining > 0; b++) {
+		if (dip->addrs[b] == 0 || dip->addrs[b] >= fc->sb->size) {continue;}
+
+		struct xv6_dirent *de =(struct xv6_dirent *)BLOCK_ADDR(fc, lg, dip->addrs[b]);
+
+		int entries = GEO_DPB(lg);
+		if (entries * sizeof(struct xv6_dirent) > remaining) { entries = remaining / sizeof(struct xv6_dirent);}
+
+		for (int i = 0; i < entries; i++, de++) {
+			process_dirent(q, de, dir_inum, b * GEO_DPB(lg) + i, &found_parent, &found_self);
+			if (walk_pruned(fc, dir_inum, b * GEO_DPB(lg) + i)) {return;}
+		}
+
+		remaining -= entries * sizeof(struct xv6_dirent);
+	}
+
+	/* ---------- Indirect blocks ---------- */
+	if (remaining > 0 && dip->addrs[NDIRECT] != 0 && dip->addrs[NDIRECT] < fc->sb->size) {
+
+		uint *indirect =(uint *)BLOCK_ADDR(fc, lg, dip->addrs[NDIRECT]);
+
+		for (int b = 0; b < (int)GEO_NINDIRECT(lg) && remaining > 0; b++) {
+			if (indirect[b] == 0 || indirect[b] >= fc->sb->size){continue;}
+
+			struct xv6_dirent *de =(struct xv6_dirent *)BLOCK_ADDR(fc, lg, indirect[b]);
+
+			int entries = GEO_DPB(lg);
+			if (entries * sizeof(struct xv6_dirent) > remaining) {entries = remaining / sizeof(struct xv6_dirent);}
+
+			for (int i = 0; i < entries; i++, de++) {
+				process_dirent(q, de, dir_inum, (NDIRECT + b) * GEO_DPB(lg) + i, &found_parent, &found_self);
+				if (walk_pruned(fc, dir_inum, (NDIRECT + b) * GEO_DPB(lg) + i)) {return;}
+			}
+
+		remaining -= entries * sizeof(struct xv6_dirent);
+		}
+	}
+
+
+	if (found_self && found_parent) { return;}
+
+	walk_fail(fc, FCHECK_ERR_DIR_FORMAT, dir_inum, dir_inum, WALK_END, NULL);
+}
+
+//Directory walk of one walker
+//checks directories from its own deque and steals from the others when it runs dry
+//stops when no directory is queued or being checked anywhere, or memory runs out;
+//after an error the directories that can't hold an earlier one are skipped by check_directory()
+KERNEL void walk_directories_lg(struct dir_deque *own, int lg){
+ struct fcheck *fc = own->fc;
+ int inum, k;
+
+ while (__atomic_load_n(&fc->out_of_memory, __ATOMIC_SEQ_CST) == 0){
+  bool found = deque_take(own, false, &inum);
+  for (k = 1; k < fc->nwalkers && !found; k++){						//try the other deques in turn
+   found = deque_take(&fc->walk_deques[(own->id + k) % fc->nwalkers], true, &inum);
+  }
+
+  if (found){
+   check_directory(own, inum, lg);
+   __atomic_sub_fetch(&fc->walk_pending, 1, __ATOMIC_SEQ_CST);
+  } else if (__atomic_load_n(&fc->walk_pending, __ATOMIC_SEQ_CST) == 0){
+   break;
+  } else {
+   sched_yield();										//work is still being checked, new directories may appear
+  }
+ }
+}
+
+//Thread function for the directory walk, runs the walk compiled for the image's block size
+static void* walk_directories(void *arg){
+ struct dir_deque *own = arg;
+ switch (own->fc->lg){
+ case 10: walk_directories_lg(own, 10); break;
+ case 12: walk_directories_lg(own, 12); break;
+ default: walk_directories_lg(own, 9); break;
+ }
+ return NULL;
+}
+
+//Function to traverse directories from the given inode
+//uses arena allocated deques instead of recursion, so deep trees cannot overflow the stack
+//with -j the deques are shared by nthreads walkers that steal work from each other,
+//link counts and visited flags are updated atomically so the results match a serial walk
+//this function assumes that we've already validated every inode
+//returns the first error found by the walk, errors are recorded instead with --all
+static int print_directory_contents(struct fcheck *fc, int dir_inum) {
+	int k, started;
+
+	fc->nwalkers = MIN(fc->nthreads, (int)fc->sb->ninodes);
+	if (fc->nwalkers < 1) {fc->nwalkers = 1;}
+	fc->walk_deques = (struct dir_deque *)fcheck_alloc(fc, fc->nwalkers * sizeof(struct dir_deque));
+	for (k = 0; k < fc->nwalkers; k++) {
+		fc->walk_deques[k].fc = fc;
+		fc->walk_deques[k].id = k;
+		pthread_mutex_init(&fc->walk_deques[k].lock, NULL);
+	}
+
+	deque_push(&fc->walk_deques[0], dir_inum);
+	if (fc->nwalkers == 1) {
+		walk_directories(&fc->walk_deques[0]);
+	} else {
+		pthread_t *threads = (pthread_t *)fcheck_alloc(fc, fc->nwalkers * sizeof(pthread_t));
+		for (started = 0; started < fc->nwalkers; started++) {
+			if (pthread_create(&threads[started], NULL, walk_directories, &fc->walk_deques[started]) != 0) {break;}
+		}
+		if (started < fc->nwalkers) {
+			walk_directories(&fc->walk_deques[started]);				//a thread could not be started, this one walks in its place
+		}
+		for (k = 0; k < started; k++) {
+			pthread_join(threads[k], NULL);
+		}
+	}
+	for (k = 0; k < fc->nwalkers; k++) {
+		pthread_mutex_destroy(&fc->walk_deques[k].lock);
+	}
+
+	if (fc->out_of_memory) {
+		fail(fc, FCHECK_ERR_NO_MEMORY, -1, -1, NULL);
+	}
+	return fc->walk_error;
+}
+
+//Claim a block in the reverse index for one address of an inode
+//the owner is the first claim in scan order, the lowest inode and within it the lowest logical block,
+//whichever scan thread gets there first; the indirect block of an inode is only recorded in a free entry
+//and gives way to data, tests 7 and 8 don't check those addresses
+//returns the claim that repeats an earlier one, this claim or the claim of a later inode it displaced, 0 if none
+static uint64_t claim_block(struct fcheck *fc, uint block, uint64_t claim){
+ uint64_t *entry = &fc->owners[block];
+ uint64_t old = __atomic_load_n(entry, __ATOMIC_RELAXED);
+ bool weak = OWNER_ROLE(claim) == FCHECK_ROLE_INDIRECT_BLOCK;
+
+ for (;;){
+  if (old == 0 || (!weak && OWNER_ROLE(old) == FCHECK_ROLE_INDIRECT_BLOCK)){
+   if (__atomic_compare_exchange_n(entry, &old, claim, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {return 0;}
+  } else if (weak){
+   return 0;
+  } else if (OWNER_ORDER(claim) < OWNER_ORDER(old)){						//a later inode got here first, it is the repeat
+   if (__atomic_compare_exchange_n(entry, &old, claim | OWNER_SHARED, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+    return old & ~OWNER_SHARED;
+   }
+  } else {
+   __atomic_fetch_or(entry, OWNER_SHARED, __ATOMIC_RELAXED);
+   return claim;
+  }
+ }
+}
+
+//Helper function for the inode scan, records a bad address of an inode for test 2
+//the first one of a shard is kept without --all, in inode and then address order
+KERNEL void address_error(struct scan_shard *s, int err, int inum, uint block){
+ if (s->fc->all_mode){
+  thread_error_add(s->fc, &s->errors, err, inum, block, NULL);
+ } else if (s->addr_error == FCHECK_ERR_NONE){
+  s->addr_error = err;
+  s->addr_inum = inum;
+  s->addr_block = block;
+ }
+}
+
+//Helper function for the inode scan
+//runs every check that needs a single block address of inode inum
+//offset is the logical block the address holds, addresses below NDIRECT are direct
+//block is never 0, bad is set by address_lanes() when it lies outside the data blocks
+KERNEL void scan_address(struct scan_shard *s, int lg, int inum, uint block, bool allocated, int offset, bool bad){
+ struct fcheck *fc = s->fc;
+ struct superblock *sb = fc->sb;
+ bool direct = offset < NDIRECT;
+
+ //every block of an allocated inode must be marked in use in the bitmap
+ //blocks inside the image are compared with the bitmap in bulk by merge_shards(),
+ //--all probes each block instead so the owning inode can be reported
+ //blocks past the end of the image have no bitmap bit, test 2 reports them
+ if (allocated && block < sb->size){
+  if (!fc->all_mode){
+   block_map_set(&s->alloc_used, block);
+  } else if (get_bit(fc, lg, block) != 1){
+   thread_error_add(fc, &s->errors, FCHECK_ERR_BITMAP_FREE, inum, block, NULL);
+  }
+ }
+
+ if (inum < sb->ninodes && block < sb->size){							//record block for test #6
+  block_map_set(&s->block_used, block);
+ }
+
+ if (inum == 0) {return;}									//tests 2, 7 and 8 start at inode 1
+
+ if (bad){											//record bad address for test #2
+  address_error(s, direct ? FCHECK_ERR_BAD_DIRECT : FCHECK_ERR_BAD_INDIRECT, inum, block);
+ }
+
+ if (block > sb->size) {return;}								//out of range blocks have no owner, test 2 reports them
+
+ uint64_t dup = claim_block(fc, block, OWNER(inum, offset, direct ? FCHECK_ROLE_DIRECT : FCHECK_ROLE_INDIRECT));	//record the owner for tests #7 and #8
+ if (dup != 0){
+  if (fc->all_mode){
+   int err = (OWNER_ROLE(dup) == FCHECK_ROLE_DIRECT) ? FCHECK_ERR_DUP_DIRECT : FCHECK_ERR_DUP_INDIRECT;
+   thread_error_add(fc, &s->errors, err, OWNER_INUM(dup), block, NULL);
+  } else if (s->first_dup == 0 || OWNER_ORDER(dup) < OWNER_ORDER(s->first_dup)){
+   s->first_dup = dup;
+   s->first_dup_block = block;
+  }
+ }
+}
+
+//Helper function for the inode scan, records an error of tests 15 to 17
+//the scan goes on, these errors come after every other scan error
+KERNEL void inode_error(struct scan_shard *s, int err, int inum){
+ if (s->fc->all_mode){
+  thread_error_add(s->fc, &s->errors, err, inum, -1, NULL);
+ } else if ((s->inode_errors & (1u << err)) == 0){
+  s->inode_errors |= 1u << err;
+  s->inode_error_inum[err] = inum;
+ }
+}
+
+//Helper function for the inode scan
+//checks the fields of an allocated inode against each other, with nothing but the inode itself
+//last is one past its highest logical block holding an address, -1 if its indirect block lies outside
+//the data blocks: test 2 reports it, and what it points at isn't a list of the inode's blocks
+//xv6 files have no holes and itrunc frees the indirect block, so the blocks must be exactly
+//the first size / BSIZE rounded up; devices need a known major number and a directory holds whole entries
+KERNEL void scan_inode_fields(struct scan_shard *s, int lg, int inum, struct dinode *ip, int last){
+ uint need = ((size_t)ip->size + GEO_BSIZE(lg) - 1) >> lg;					//blocks the size covers
+ if (last >= 0 && need > (uint)last){
+  inode_error(s, FCHECK_ERR_SIZE_SHORT, inum);
+ }
+ if (last >= 0 && ((uint)last > need || (ip->addrs[NDIRECT] != 0 && need <= NDIRECT))){
+  inode_error(s, FCHECK_ERR_PAST_EOF, inum);
+ }
+ if (ip->type == T_DEV && (ip->major < 1 || ip->major >= NDEV)){
+  inode_error(s, FCHECK_ERR_DEVICE, inum);
+ }
+ if (ip->type == T_DIR && ip->size % sizeof(struct xv6_dirent) != 0){
+  inode_error(s, FCHECK_ERR_DIR_SIZE, inum);
+ }
+}
+
+//Scan the inodes of one shard
+//every inode and indirect block in the range is read exactly once and feeds all of the checks
+//the inodes are validated VLANES at a time and the addresses of each inode and indirect block
+//are range checked a vector at a time; only the lanes holding a block go on to scan_address()
+//the fields of each allocated inode are checked last, from the same loads
+KERNEL void scan_range_lg(struct scan_shard *s, int lg){
+ struct fcheck *fc = s->fc;
+ struct superblock *sb = fc->sb;
+ uint start = sb->size - sb->nblocks;
+ int base, inum, i;
+ uint used, bad;
+
+ for(base = s->first; base < s->last; base += VLANES){
+  int n = MIN(VLANES, s->last - base);
+  uint invalid = invalid_inodes(fc, lg, base, n);
+  for(inum = base; inum < base + n; inum++){
+   struct dinode *ip = INODE_ADDR(fc, lg, inum);
+   bool allocated = false;
+
+   fc->inodes.type[inum] = ip->type;								//save type for the directory walk and tests #11 and #12
+   fc->inodes.nlink[inum] = ip->nlink;
+
+   if (inum >= 1){
+    if (invalid & (1u << (inum - base))){
+     if (!fc->all_mode){
+      s->fatal_error = FCHECK_ERR_BAD_INODE;
+      s->fatal_inum = inum;
+      return;
+     }
+     thread_error_add(fc, &s->errors, FCHECK_ERR_BAD_INODE, inum, -1, NULL);
+     fc->inodes.type[inum] = 0;
+     continue;											//the rest of a bad inode can't be trusted
+    }
+    if (inum == 1 && ip->size == 0){
+     if (!fc->all_mode){
+      s->fatal_error = FCHECK_ERR_NO_ROOT;
+      s->fatal_inum = inum;
+      return;
+     }
+     thread_error_add(fc, &s->errors, FCHECK_ERR_NO_ROOT, inum, -1, NULL);
+    }
+    if (ip->type != 0){
+     fc->active_inode_list[inum] = 1;								//inode must be found in a directory later
+     allocated = true;
+    }
+   }
+
+   uint addrs[VLANES] = {0};
+   memcpy(addrs, ip->addrs, sizeof(ip->addrs));							//direct addresses and the indirect block
+   used = address_lanes(addrs, start, sb->size, &bad);
+   uint indirect_bad = (bad >> NDIRECT) & 1;
+   used &= (1u << NDIRECT) - 1;
+   fc->inodes.size[inum] = ip->size;
+   int last = used ? 32 - __builtin_clz(used) : 0;
+   for (; used != 0; used &= used - 1){								//lowest lane first, in address order
+    i = __builtin_ctz(used);
+    scan_address(s, lg, inum, addrs[i], allocated, i, (bad >> i) & 1);
+   }
+
+   if (inum >= 1 && indirect_bad){								//the indirect block must be a data block too (test #2)
+    address_error(s, FCHECK_ERR_BAD_INDIRECT, inum, ip->addrs[NDIRECT]);
+   }
+   if (ip->addrs[NDIRECT] != 0 && ip->addrs[NDIRECT] < sb->size){				//skip if unassigned, one outside the image can't be read
+    if (inum < sb->ninodes){									//indirect block itself is in use
+     block_map_set(&s->block_used, ip->addrs[NDIRECT]);
+    }
+    if (inum >= 1){
+     claim_block(fc, ip->addrs[NDIRECT], OWNER(inum, 0, FCHECK_ROLE_INDIRECT_BLOCK));
+    }
+
+    //walk the indirect block in place, a vector at a time
+    uint *indirect = (uint *)BLOCK_ADDR(fc, lg, ip->addrs[NDIRECT]);
+    for (i = 0; i < (int)GEO_NINDIRECT(lg); i += VLANES){
+     used = address_lanes(indirect + i, start, sb->size, &bad);
+     if (used != 0) {last = NDIRECT + i + 32 - __builtin_clz(used);}
+     for (; used != 0; used &= used - 1){
+      int k = __builtin_ctz(used);
+      scan_address(s, lg, inum, indirect[i + k], allocated, NDIRECT + i + k, (bad >> k) & 1);
+     }
+    }
+   }
+
+   if (allocated) {scan_inode_fields(s, lg, inum, ip, indirect_bad ? -1 : last);}		//tests #15 to #17
+  }
+ }
+}
+
+//Scan the inodes of one shard with the scan compiled for the image's block size
+//used directly for a serial scan and as the thread function for -j
+static void* scan_range(void *arg){
+ struct scan_shard *s = arg;
+ switch (s->fc->lg){
+ case 10: scan_range_lg(s, 10); break;
+ case 12: scan_range_lg(s, 12); break;
+ default: scan_range_lg(s, 9); break;
+ }
+ return NULL;
+}
+
+//Find the first address of an allocated inode of a shard that the bitmap marks free (test 5)
+//merge_shards() only compares the shard's map with the bitmap, this reads the inodes of the shard
+//again to name the inode, once the check has failed; the scan stopped at a fatal error, so does this
+//returns the block and sets inum, -1 if there is none
+static long bitmap_free_address(struct fcheck *fc, struct scan_shard *s, int *inum){
+ int lg = fc->lg, i;
+ uint k, size = fc->sb->size;
+ int last = (s->fatal_error != FCHECK_ERR_NONE) ? s->fatal_inum : s->last;
+
+ for (i = (s->first > 1) ? s->first : 1; i < last; i++){
+  struct dinode *ip = INODE_ADDR(fc, lg, i);
+  if (ip->type == 0) {continue;}
+  *inum = i;
+  for (k = 0; k < NDIRECT; k++){
+   if (ip->addrs[k] != 0 && ip->addrs[k] < size && get_bit(fc, lg, ip->addrs[k]) != 1) {return ip->addrs[k];}
+  }
+  if (ip->addrs[NDIRECT] == 0 || ip->addrs[NDIRECT] >= size) {continue;}
+  uint *indirect = (uint *)BLOCK_ADDR(fc, lg, ip->addrs[NDIRECT]);
+  for (k = 0; k < GEO_NINDIRECT(lg); k++){
+   if (indirect[k] != 0 && indirect[k] < size && get_bit(fc, lg, indirect[k]) != 1) {return indirect[k];}
+  }
+ }
+ return -1;
+}
+
+//Combine the shards in inode order so the results match a serial scan
+//the first fatal error exits, the other results are stored for the test functions
+//a shard stops at its fatal error, so a block marked free in its alloc_used map came first
+//the first repeated address is the earliest in scan order of the ones every shard found
+//with --all every shard's errors are moved to the context's list
+static void merge_shards(struct fcheck *fc, int nshards){
+ int k, i;
+ uint64_t first_dup = 0;
+
+ for(k = 0; k < nshards && !fc->all_mode; k++){
+  if (bitmap_mismatch(fc, &fc->shards[k].alloc_used, true, 0) >= 0){
+   int inum = -1;
+   long block = bitmap_free_address(fc, &fc->shards[k], &inum);
+   fail(fc, FCHECK_ERR_BITMAP_FREE, inum, block, NULL);
+  }
+  if (fc->shards[k].fatal_error != FCHECK_ERR_NONE){
+   fail(fc, fc->shards[k].fatal_error, fc->shards[k].fatal_inum, -1, NULL);
+  }
+ }
+
+ for(k = 0; k < nshards; k++){
+  struct scan_shard *s = &fc->shards[k];
+
+  if (fc->addr_error == FCHECK_ERR_NONE && s->addr_error != FCHECK_ERR_NONE){
+   fc->addr_error = s->addr_error;
+   fc->addr_inum = s->addr_inum;
+   fc->addr_block = s->addr_block;
+  }
+  for (uint found = s->inode_errors & ~fc->inode_errors; found != 0; found &= found - 1){	//errors no earlier shard found
+   fc->flagged[__builtin_ctz(found)].inum = s->inode_error_inum[__builtin_ctz(found)];
+  }
+  fc->inode_errors |= s->inode_errors;
+  block_map_merge(&fc->block_used, &s->block_used);
+
+  if (fc->all_mode){
+   for(i = 0; i < s->errors.count; i++){
+    struct fcheck_result *e = &s->errors.errors[i];
+    fail(fc, e->err, e->inum, e->block, NULL);
+   }
+   continue;
+  }
+
+  if (s->first_dup != 0 && (first_dup == 0 || OWNER_ORDER(s->first_dup) < OWNER_ORDER(first_dup))){
+   first_dup = s->first_dup;
+   fc->dup_block = s->first_dup_block;
+  }
+ }
+ if (first_dup != 0){
+  fc->dup_error = (OWNER_ROLE(first_dup) == FCHECK_ROLE_DIRECT) ? FCHECK_ERR_DUP_DIRECT : FCHECK_ERR_DUP_INDIRECT;
+  fc->dup_inum = OWNER_INUM(first_dup);
+ }
+}
+
+//Scan the inode table
+//bad inodes, a missing root and blocks marked free are reported right away,
+//results for tests 2, 6 and 7/8 and the inode summary are stored for the checks after the scan
+//with -j the inode range is split across threads, each with its own shard
+static void scan_inodes(struct fcheck *fc){
+ struct superblock *sb = fc->sb;
+ int i, k, started;
+
+ int niblock = (sb->ninodes >> (fc->lg - LG_INODE));						//calculate the number of inode blocks needed
+ if((sb->ninodes & (GEO_IPB(fc->lg) - 1)) != 0){
+  niblock ++;
+ }
+
+ int bmblock = (sb->size >> (fc->lg + 3));							//calculate the number of bitmap blocks needed
+ if((sb->size & ((GEO_BSIZE(fc->lg) << 3) - 1)) != 0){
+  bmblock ++;
+ }
+
+ int metablocks = 2 + niblock + bmblock;							//total overhead blocks =  2 + inodes + bitmap
+ for(i = 0; i < MIN(metablocks + 1, (int)sb->size); i++){					//overhead blocks are always in use
+  block_map_set(&fc->block_used, i);
+ }
+
+ int ninodes = sb->ninodes + 1;									//inodes 0 to ninodes are scanned
+ int nshards = MIN(fc->nthreads, ninodes);
+ if (nshards < 1) {nshards = 1;}
+ fc->shards = (struct scan_shard *)fcheck_alloc(fc, nshards * sizeof(struct scan_shard));
+
+ for(k = 0; k < nshards; k++){
+  struct scan_shard *s = &fc->shards[k];
+  s->fc = fc;
+  s->first = (long)ninodes * k / nshards;
+  s->last = (long)ninodes * (k + 1) / nshards;
+  fcheck_map(fc, &s->block_used, sb->size);
+  fcheck_map(fc, &s->alloc_used, sb->size);
+ }
+
+ if (nshards == 1){
+  scan_range(&fc->shards[0]);
+ } else {
+  pthread_t *threads = (pthread_t *)fcheck_alloc(fc, nshards * sizeof(pthread_t));
+  for(started = 0; started < nshards; started++){
+   if (pthread_create(&threads[started], NULL, scan_range, &fc->shards[started]) != 0) {break;}
+  }
+  for(k = started; k < nshards; k++){								//shards whose thread could not be started are scanned here
+   scan_range(&fc->shards[k]);
+  }
+  for(k = 0; k < started; k++){
+   pthread_join(threads[k], NULL);
+  }
+ }
+
+ if (fc->out_of_memory){
+  fail(fc, FCHECK_ERR_NO_MEMORY, -1, -1, NULL);
+ }
+ fc->owners_complete = true;									//a shard that stopped early left inodes unclaimed
+ for(k = 0; k < nshards; k++){
+  if (fc->shards[k].fatal_error != FCHECK_ERR_NONE) {fc->owners_complete = false;}
+ }
+ merge_shards(fc, nshards);
+}
+
+//Report an error found by a scheduled check
+//with --all the error is recorded and the check goes on, FCHECK_ERR_NONE is returned;
+//otherwise the error is saved in r for the scheduler and returned so the check can stop
+static int check_error(struct fcheck *fc, struct fcheck_result *r, int err, int inum, long block, const char *name){
+ if (fc->all_mode){
+  fail(fc, err, inum, block, name);
+  return FCHECK_ERR_NONE;
+ }
+ result_set(r, err, inum, block, name);
+ return err;
+}
+
+//Turn the links found by the walk into the path table
+//each distinct name is kept once, found through an open addressing table on the name, and every link
+//then holds its name's offset; the names are packed in place at the start of path_names, a name
+//never takes more than the PATH_SLOT bytes of the slot it is read from, so packing can't overwrite
+//a slot not yet read. The table costs at most about 40 bytes an inode and fcheck_path follows it
+//to the root without walking the tree or reading the image
+static void intern_paths(struct fcheck *fc){
+ size_t n = 0, used = 0;
+ uint i, k, nslots = 64;
+
+ for (i = 1; i <= fc->sb->ninodes; i++) {n += fc->path_links[i] != 0;}
+ while (nslots < 2 * n) {nslots *= 2;}
+ uint *slots = (uint *)fcheck_alloc(fc, nslots * sizeof(uint));				//offset + 1 of a name, 0 if empty
+
+ for (i = 1; i <= fc->sb->ninodes; i++){
+  uint64_t link = fc->path_links[i];
+  if (link == 0) {continue;}
+  char key[PATH_SLOT];										//the name with the rest of the slot zeroed
+  memcpy(key, fc->path_names + (size_t)i * PATH_SLOT, PATH_SLOT);
+  size_t len = strnlen(key, DIRSIZ);
+  for (k = (uint)(name_hash(key) >> 32) & (nslots - 1); slots[k] != 0; k = (k + 1) & (nslots - 1)){
+   if (memcmp(fc->path_names + slots[k] - 1, key, len + 1) == 0) {break;}
+  }
+  if (slots[k] == 0){
+   memcpy(fc->path_names + used, key, len + 1);
+   slots[k] = used + 1;
+   used += len + 1;
+  }
+  fc->path_links[i] = (link & ~(uint64_t)UINT_MAX) | (slots[k] - 1);
+ }
+ fc->paths_ready = true;
+}
+
+//Scheduled task for the directory walk from the root
+//the path table is built here, so it exists whichever check fails first
+static int walk_root(struct fcheck *fc, struct fcheck_result *r){
+ int err = print_directory_contents(fc, ROOTINO);
+ if (fc->path_links != NULL) {intern_paths(fc);}
+ return (err != FCHECK_ERR_NONE) ? check_error(fc, r, err, fc->walk_error_inum, -1, fc->walk_error_name) : FCHECK_ERR_NONE;
+}
+
+//function for test case #9
+//every inode in use must be found in a directory
+static int test9(struct fcheck *fc, struct fcheck_result *r){
+ int inum;
+ for(inum = 1; inum < fc->sb->ninodes; inum++){
+  if(fc->active_inode_list[inum] == 1 && check_error(fc, r, FCHECK_ERR_NOT_IN_DIR, inum, -1, NULL) != FCHECK_ERR_NONE){
+   return FCHECK_ERR_NOT_IN_DIR;								//error for an inode no directory refers to
+  }
+ }
+ return 0; //return 0 if test passes
+}
+
+//function for test case #2
+//for each inode its blocks must point to a valid data block address in the image
+static int test2(struct fcheck *fc, struct fcheck_result *r){
+ if(fc->addr_error != FCHECK_ERR_NONE){
+  return check_error(fc, r, fc->addr_error, fc->addr_inum, fc->addr_block, NULL);		//error for bad direct or indirect inode address
+ }
+ return 0; //return 0 if test passes
+}
+
+//function for test case #6
+//for blocks marked in-use in the bitmap the block should be used by an inode or an indirect inode
+static int test6(struct fcheck *fc, struct fcheck_result *r){
+ long b;
+ //compare the bitmap created using inodes to the bitmap in the image file
+ for(b = bitmap_mismatch(fc, &fc->block_used, false, 0); b >= 0; b = bitmap_mismatch(fc, &fc->block_used, false, b + 1)){	//every block marked in the bitmap but not used
+  if(check_error(fc, r, FCHECK_ERR_BITMAP_USED, -1, b, NULL) != FCHECK_ERR_NONE){
+   return FCHECK_ERR_BITMAP_USED;								//error for data-bitmap inode inconsistency
+  }
+ }
+ return 0; //return 0 if test passes
+}
+
+//function for test case #7 and test case #8
+//direct and indirect addresses in inodes should only be used once
+static int test78(struct fcheck *fc, struct fcheck_result *r){
+ if(fc->dup_error != FCHECK_ERR_NONE){
+  return check_error(fc, r, fc->dup_error, fc->dup_inum, fc->dup_block, NULL);			//error for repeated direct or indirect address
+ }
+ return 0; //return 0 if test passes
+}
+
+//function for test case #11
+//number of links in a file does not mach its appearances in directories
+static int test11(struct fcheck *fc, struct fcheck_result *r){
+ int i;
+ for(i = 0; i < fc->sb->ninodes; i++){								//run test for every regular file
+  if(fc->inodes.type[i] != T_FILE){continue;}							//a negative on-disk count is checked like any other
+  //active_inode_list is calulated in the directory helper function
+  int refcount = fc->active_inode_list[i] - 1;							//get reference count in directories for inode
+  if(fc->inodes.nlink[i] != refcount && check_error(fc, r, FCHECK_ERR_REFCOUNT, i, -1, NULL) != FCHECK_ERR_NONE){	//compare directory references to inode links
+   return FCHECK_ERR_REFCOUNT;									//error for file reference count inconsistency
+  }
+ }
+ return 0; //return 0 if test passed
+}
+
+//function for test case #12
+//no extra links for directories: a directory has one link and one entry naming it, the root none;
+//a second entry, in another directory or in one below it forming a cycle, sets PARENT_SHARED
+static int test12(struct fcheck *fc, struct fcheck_result *r){
+ int i;
+ for(i = 1; i < fc->sb->ninodes; i++){
+  if(fc->inodes.type[i] != T_DIR) {continue;}
+  bool named_again = (fc->parent[i] & PARENT_SHARED) || (i == ROOTINO && fc->parent[i] != 0);
+  if((fc->inodes.nlink[i] > 1 || named_again) && check_error(fc, r, FCHECK_ERR_DIR_LINKS, i, -1, NULL) != FCHECK_ERR_NONE){
+   return FCHECK_ERR_DIR_LINKS;									//error for invalid directory links
+  }
+ }
+ return 0; //return 0 if test passes
+}
+
+//function for test case #13
+//the ".." of every directory the walk reached must name the directory it was found in;
+//a directory found in several directories is test 12's error and one without ".." is test 4's,
+//both are skipped. With every ".." matching, following ".." from any directory climbs the
+//tree the walk found and ends at the root, so ".." can't form a cycle
+static int test13(struct fcheck *fc, struct fcheck_result *r){
+ int i;
+ for(i = 1; i < fc->sb->ninodes; i++){
+  uint parent = fc->parent[i];
+  if(i == ROOTINO || fc->inodes.type[i] != T_DIR || parent == 0 || (parent & PARENT_SHARED) || fc->dotdot[i] == 0){continue;}
+  if(fc->dotdot[i] != parent && check_error(fc, r, FCHECK_ERR_PARENT, i, -1, NULL) != FCHECK_ERR_NONE){
+   return FCHECK_ERR_PARENT;									//error for ".." naming another directory
+  }
+ }
+ return 0; //return 0 if test passes
+}
+
+//function for test case #14
+//every directory must be reachable from the root; one that no walked directory names is cut off,
+//alone or with a group of directories naming each other in a cycle. The walk only reads
+//directories it reaches, so each directory of such a group is reported
+static int test14(struct fcheck *fc, struct fcheck_result *r){
+ int i;
+ for(i = 1; i < fc->sb->ninodes; i++){
+  if(i != ROOTINO && fc->inodes.type[i] == T_DIR && fc->parent[i] == 0 && check_error(fc, r, FCHECK_ERR_UNREACHABLE, i, -1, NULL) != FCHECK_ERR_NONE){
+   return FCHECK_ERR_UNREACHABLE;								//error for a directory cut off from the root
+  }
+ }
+ return 0; //return 0 if test passes
+}
+
+//Helper function for tests 15 to 19, reports the first error of found, bits 1 << err the scan or walk set
+//with the inode and name kept for it in flagged
+static int flag_error(struct fcheck *fc, struct fcheck_result *r, uint found){
+ if(found != 0){
+  struct fcheck_result *f = &fc->flagged[__builtin_ctz(found)];
+  return check_error(fc, r, __builtin_ctz(found), f->inum, f->block, f->name);
+ }
+ return 0; //return 0 if test passes
+}
+
+//function for test case #15
+//size must cover exactly the blocks of the inode, see scan_inode_fields()
+static int test15(struct fcheck *fc, struct fcheck_result *r){
+ return flag_error(fc, r, fc->inode_errors & ((1u << FCHECK_ERR_SIZE_SHORT) | (1u << FCHECK_ERR_PAST_EOF)));
+}
+
+//function for test case #16
+//devices need a major number xv6 knows
+static int test16(struct fcheck *fc, struct fcheck_result *r){
+ return flag_error(fc, r, fc->inode_errors & (1u << FCHECK_ERR_DEVICE));
+}
+
+//function for test case #17
+//directories hold whole entries
+static int test17(struct fcheck *fc, struct fcheck_result *r){
+ return flag_error(fc, r, fc->inode_errors & (1u << FCHECK_ERR_DIR_SIZE));
+}
+
+//function for test case #18
+//a name appears once per directory, see names_insert()
+static int test18(struct fcheck *fc, struct fcheck_result *r){
+ return flag_error(fc, r, fc->name_errors & (1u << FCHECK_ERR_DUP_NAME));
+}
+
+//function for test case #19
+//names are well formed, see name_valid()
+static int test19(struct fcheck *fc, struct fcheck_result *r){
+ return flag_error(fc, r, fc->name_errors & (1u << FCHECK_ERR_BAD_NAME));
+}
+
+//A check run by the scheduler, with the inputs it reads and produces
+static struct check_info {
+ int (*run)(struct fcheck *fc, struct fcheck_result *r);
+ int needs;			//inputs that must be produced before it runs
+ int gives;			//inputs it produces
+ int cost;			//rough cost, cheaper checks are run first
+ bool on_caller;		//allocates from the arena, so only the thread running the check may run it
+} check_info[NTASKS] = {
+ [TASK_WALK]   = {walk_root, INPUT_SUMMARY, INPUT_LINKS, 3, true},			//reads every directory block
+ [TASK_TEST9]  = {test9,  INPUT_SUMMARY | INPUT_LINKS, 0, 2, false},			//one pass over an inode array
+ [TASK_TEST2]  = {test2,  INPUT_BLOCKS, 0, 0, false},					//reads a flag left by the scan
+ [TASK_TEST6]  = {test6,  INPUT_BLOCKS, 0, 1, false},					//compares two bitmaps a word at a time
+ [TASK_TEST78] = {test78, INPUT_BLOCKS, 0, 0, false},
+ [TASK_TEST11] = {test11, INPUT_SUMMARY | INPUT_LINKS, 0, 2, false},
+ [TASK_TEST12] = {test12, INPUT_SUMMARY | INPUT_LINKS, 0, 1, false},			//one pass over three inode columns
+ [TASK_TEST13] = {test13, INPUT_SUMMARY | INPUT_LINKS, 0, 1, false},
+ [TASK_TEST14] = {test14, INPUT_SUMMARY | INPUT_LINKS, 0, 1, false},
+ [TASK_TEST15] = {test15, INPUT_BLOCKS, 0, 0, false},					//read flags left by the scan
+ [TASK_TEST16] = {test16, INPUT_BLOCKS, 0, 0, false},
+ [TASK_TEST17] = {test17, INPUT_BLOCKS, 0, 0, false},
+ [TASK_TEST18] = {test18, INPUT_LINKS, 0, 0, false},					//read flags left by the walk
+ [TASK_TEST19] = {test19, INPUT_LINKS, 0, 0, false},
+};
+
+//Pick the next check a thread may run, called with tasks_lock held
+//a check is ready once its inputs exist; checks reported after a failed one are never started,
+//since their errors could not be the first; among the ready checks the cheapest goes first
+//returns the task, or -1 if none is ready
+static int next_task(struct fcheck *fc, bool caller){
+ int t, best = -1;
+ for(t = 0; t < fc->first_failed; t++){
+  if(fc->tasks[t].status != TASK_PENDING || (check_info[t].needs & ~fc->inputs) != 0) {continue;}
+  if(check_info[t].on_caller && !caller) {continue;}
+  if(best < 0 || check_info[t].cost < check_info[best].cost) {best = t;}
+ }
+ return best;
+}
+
+//Run a check picked by next_task(), called with tasks_lock held, which is released while it runs
+static void run_task(struct fcheck *fc, int t){
+ fc->tasks[t].status = TASK_RUNNING;
+ pthread_mutex_unlock(&fc->tasks_lock);
+ int err = check_info[t].run(fc, &fc->tasks[t].first);
+ pthread_mutex_lock(&fc->tasks_lock);
+ fc->tasks[t].status = TASK_DONE;
+ fc->inputs |= check_info[t].gives;
+ if(err != FCHECK_ERR_NONE && t < fc->first_failed) {fc->first_failed = t;}
+ pthread_cond_broadcast(&fc->tasks_changed);
+}
+
+//Thread function for the helper of -j, runs every check it may run until told to exit
+static void* task_helper(void *arg){
+ struct fcheck *fc = arg;
+ pthread_mutex_lock(&fc->tasks_lock);
+ while(!fc->helper_stop){
+  int t = next_task(fc, false);
+  if(t >= 0) {run_task(fc, t);}
+  else {pthread_cond_wait(&fc->tasks_changed, &fc->tasks_lock);}
+ }
+ pthread_mutex_unlock(&fc->tasks_lock);
+ return NULL;
+}
+
+//Stop and join the helper thread if it was started
+static void stop_helper(struct fcheck *fc){
+ if(!fc->helper_started) {return;}
+ pthread_mutex_lock(&fc->tasks_lock);
+ fc->helper_stop = true;
+ pthread_cond_broadcast(&fc->tasks_changed);
+ pthread_mutex_unlock(&fc->tasks_lock);
+ pthread_join(fc->helper, NULL);
+ fc->helper_started = false;
+}
+
+//Run the checks that follow the inode scan as a graph of tasks
+//every check waits for the inputs it reads, so with -j a helper thread runs the checks that only
+//need the scan while the calling thread walks the directories; without -j they run in cost order
+//the first error is still the one a fixed order would report: once a check fails, checks reported
+//after it are dropped and only the ones reported before it are waited for
+static void fcheck_schedule(struct fcheck *fc){
+ int t;
+
+ memset(fc->tasks, 0, sizeof(fc->tasks));
+ fc->inputs = INPUT_SUMMARY | INPUT_BLOCKS;							//the scan is done
+ fc->first_failed = NTASKS;
+ fc->helper_stop = false;
+ if(fc->nthreads > 1 && pthread_create(&fc->helper, NULL, task_helper, fc) == 0){		//no helper means every check runs here
+  fc->helper_started = true;
+ }
+
+ pthread_mutex_lock(&fc->tasks_lock);
+ while(true){
+  for(t = 0; t < fc->first_failed && fc->tasks[t].status == TASK_DONE; t++);
+  if(t >= fc->first_failed) {break;}								//every check that could report first is done
+  if((t = next_task(fc, true)) >= 0) {run_task(fc, t);}
+  else {pthread_cond_wait(&fc->tasks_changed, &fc->tasks_lock);}
+ }
+ pthread_mutex_unlock(&fc->tasks_lock);
+ stop_helper(fc);
+
+ if(fc->first_failed < NTASKS){
+  struct fcheck_result *e = &fc->tasks[fc->first_failed].first;
+  fail(fc, e->err, e->inum, e->block, e->name[0] ? e->name : NULL);
+ }
+}
+
+//Set up an empty context, nothing is allocated until the first image is checked
+static void fcheck_init(struct fcheck *fc){
+ memset(fc, 0, sizeof(*fc));
+ fc->nthreads = 1;
+ fc->fsfd = -1;
+ pthread_mutex_init(&fc->errors_lock, NULL);
+ pthread_mutex_init(&fc->tasks_lock, NULL);
+ pthread_cond_init(&fc->tasks_changed, NULL);
+}
+
+//Release everything a context holds
+static void fcheck_free(struct fcheck *fc){
+ arena_free(&fc->arena);
+ pthread_mutex_destroy(&fc->errors_lock);
+ pthread_mutex_destroy(&fc->tasks_lock);
+ pthread_cond_destroy(&fc->tasks_changed);
+}
+
+//Bytes of arena the open image needs before any error is recorded
+//covers the inode arrays, the reverse index, the block maps of the context and of every scan shard,
+//and the deques of the directory walk, each rounded up to the arena alignment
+static size_t fcheck_memory(struct fcheck *fc){
+ size_t ninodes = fc->sb->ninodes + 1;
+ size_t map = MAP_WORDS((size_t)fc->sb->size + 1) * sizeof(uint64_t) + ARENA_ALIGN;
+ size_t nthreads = MIN((size_t)fc->nthreads, ninodes);
+ if (nthreads < 1) {nthreads = 1;}
+
+ size_t need = ninodes * (sizeof(ushort) + sizeof(uchar) + sizeof(short) + sizeof(uint)) + 4 * ARENA_ALIGN;
+ need += ninodes * 2 * sizeof(uint) + 2 * ARENA_ALIGN;						//parent and dotdot
+ need += ninodes * 2 * sizeof(uint64_t) + 2 * ARENA_ALIGN;					//walk_from and walk_order
+ need += MAP_WORDS(ninodes) * sizeof(uint64_t) + ARENA_ALIGN;					//dir_visited
+ if (fc->want_paths){										//path_links, path_names and the table at most
+  need += ninodes * (sizeof(uint64_t) + PATH_SLOT + 4 * sizeof(uint)) + 3 * ARENA_ALIGN + 64 * sizeof(uint);
+ }
+ need += map + ((size_t)fc->sb->size + 1) * sizeof(uint64_t) + ARENA_ALIGN;			//block_used and owners
+ need += nthreads * (sizeof(struct scan_shard) + sizeof(pthread_t) + 2 * map + 2 * ARENA_ALIGN);
+ need += nthreads * (sizeof(struct dir_deque) + sizeof(pthread_t) + 64 * sizeof(int) + 3 * ARENA_ALIGN);
+ return need;
+}
+
+//Bytes to reserve for the arena of the open image
+static size_t fcheck_arena_size(struct fcheck *fc){
+ return fc->mem_limit ? fc->mem_limit : 2 * fcheck_memory(fc) + ARENA_SLACK;
+}
+
+//Read the image bytes of blocks [first, last) to the same offset of the buffer
+//with O_DIRECT the range is widened to IO_ALIGN, the buffer is padded to allow it
+//returns false if the image could not be read
+static bool io_read(struct fcheck *fc, size_t first, size_t last){
+ size_t start = first * GEO_BSIZE(fc->lg);
+ size_t end = MIN(last * GEO_BSIZE(fc->lg), fc->image_size);
+ if (fc->io == FCHECK_IO_DIRECT){
+  start &= ~(size_t)(IO_ALIGN - 1);
+  end = (end + IO_ALIGN - 1) & ~(size_t)(IO_ALIGN - 1);
+ }
+ while (start < end){
+  ssize_t n = pread(fc->fsfd, fc->addr + start, end - start, start);
+  if (n < 0 && errno == EINTR) {continue;}
+  if (n <= 0) {return n == 0;}									//0 is the end of the image
+  start += n;
+  if (start >= fc->image_size) {break;}							//a direct read stops short at the end
+ }
+ return true;
+}
+
+//Read every block claimed in m, runs of blocks closer than IO_GAP are read with one call
+static bool io_read_map(struct fcheck *fc, struct block_map *m){
+ uint b = 0;
+ while (b < m->nblocks){
+  uint64_t word = m->used[b / 64] >> (b % 64);
+  if (word == 0){											//skip a word with nothing left to read
+   b = (b / 64 + 1) * 64;
+   continue;
+  }
+  b += __builtin_ctzll(word);
+  uint first = b, last = b;
+  for (b++; b < m->nblocks && b - last <= IO_GAP; b++){
+   if (block_map_test(m, b)) {last = b;}
+  }
+  if (!io_read(fc, first, last + 1)) {return false;}
+  b = last + 1;
+ }
+ return true;
+}
+
+//Read the parts of the image the checks look at into the buffer of a read backend
+//the inode table and bitmap come first, then the indirect blocks of every inode
+//and the direct blocks of directories, then the blocks listed in directory indirect blocks
+//file contents are never read, that part of the buffer is never backed by memory
+//returns NULL on success or a message saying why the image can't be read
+static const char* io_load(struct fcheck *fc){
+ struct superblock *sb = fc->sb;
+ size_t nimage = (fc->image_size + GEO_BSIZE(fc->lg) - 1) >> fc->lg;
+ struct block_map want;
+ uint inum, i;
+
+ if (!io_read(fc, 2, MIN((size_t)GEO_BBLOCK(fc->lg, sb->size, sb->ninodes) + 1, nimage))) {return "image could not be read.";}	//inode table and bitmap
+
+ if (!block_map_init(&fc->arena, &want, sb->size)) {return "out of memory.";}
+ for (inum = 0; inum <= sb->ninodes; inum++){
+  struct dinode *ip = INODE_ADDR(fc, fc->lg, inum);
+  for (i = 0; i <= NDIRECT; i++){
+   if (ip->addrs[i] == 0 || ip->addrs[i] >= sb->size) {continue;}
+   if (i == NDIRECT || ip->type == T_DIR) {block_map_set(&want, ip->addrs[i]);}
+  }
+ }
+ if (!io_read_map(fc, &want)) {return "image could not be read.";}
+
+ if (!block_map_init(&fc->arena, &want, sb->size)) {return "out of memory.";}
+ for (inum = 0; inum <= sb->ninodes; inum++){
+  struct dinode *ip = INODE_ADDR(fc, fc->lg, inum);
+  if (ip->type != T_DIR || ip->addrs[NDIRECT] == 0 || ip->addrs[NDIRECT] >= sb->size) {continue;}
+  uint *indirect = (uint *)BLOCK_ADDR(fc, fc->lg, ip->addrs[NDIRECT]);
+  for (i = 0; i < GEO_NINDIRECT(fc->lg); i++){
+   if (indirect[i] != 0 && indirect[i] < sb->size) {block_map_set(&want, indirect[i]);}
+  }
+ }
+ return io_read_map(fc, &want) ? NULL : "image could not be read.";
+}
+
+//Pick the block size of an image whose first two blocks of the largest geometry are in memory
+//the size given by the caller wins, otherwise the first geometry whose superblock describes
+//a file system that fills the image exactly, 512 bytes if none does
+//returns the log2 of the block size, or -1 if the caller's size has no compiled kernels
+static int detect_lg(struct fcheck *fc){
+ int k;
+ for (k = 0; k < NGEOMETRIES; k++){
+  int lg = geometries[k];
+  if (fc->block_size != 0){
+   if (GEO_BSIZE(lg) == (size_t)fc->block_size) {return lg;}
+   continue;
+  }
+  if (2 * GEO_BSIZE(lg) > fc->image_size) {break;}
+  struct superblock *sb = (struct superblock *)BLOCK_ADDR(fc, lg, 1);
+  if ((size_t)sb->size << lg == fc->image_size) {return lg;}
+ }
+ return fc->block_size ? -1 : LG_MIN;
+}
+
+//Check the superblock of an image whose first two blocks are in memory and bring in the rest
+//a caller's buffer already holds the whole image, mmap is only advised, the read backends use io_load()
+//returns NULL on success or a message saying why the image can't be checked
+static const char* fcheck_prepare(struct fcheck *fc){
+ if((fc->lg = detect_lg(fc)) < 0){
+  return "block size not supported.";
+ }
+ if(2 * GEO_BSIZE(fc->lg) > fc->image_size){							//need at least the boot block and the superblock
+  return "image too small.";
+ }
+ fc->sb = (struct superblock *)BLOCK_ADDR(fc, fc->lg, 1);					//find the superblock in the image
+ if(((size_t)fc->sb->size << fc->lg) > fc->image_size || GEO_BMAPSTART(fc->lg, fc->sb->ninodes) > fc->sb->size){	//superblock must describe a file system that fits
+  return "image smaller than its file system.";
+ }
+ if(fc->mem_limit != 0 && fcheck_memory(fc) > fc->mem_limit){					//image must fit in the memory limit
+  return "image needs more memory than the memory limit allows.";
+ }
+
+ if(!fc->owns_map){
+  return NULL;
+ }
+ if(fc->io == FCHECK_IO_MMAP){
+  madvise(fc->addr, fc->image_size, MADV_RANDOM);						//directory and indirect blocks are scattered
+  madvise(fc->addr, MIN((size_t)GEO_BBLOCK(fc->lg, fc->sb->size, fc->sb->ninodes) + 1, fc->image_size >> fc->lg) << fc->lg, MADV_WILLNEED);	//inode table and bitmap are read in full
+  return NULL;
+ }
+ if(!arena_reserve(&fc->arena, fcheck_arena_size(fc))){					//io_load keeps its block lists in the arena
+  return "out of memory.";
+ }
+ return io_load(fc);
+}
+
+//Open an image file and bring it into memory with the context's backend
+//returns NULL on success or a message saying why the image can't be checked
+const char* fcheck_open(struct fcheck *fc, const char *path){
+ int fd = open(path, O_RDONLY | (fc->io == FCHECK_IO_DIRECT ? O_DIRECT : 0));			//attempt to open file
+ if( fd < 0 ){											//exit with error if file no found
+   return (errno == EINVAL) ? "image does not support direct I/O." : "image not found.";
+ }
+
+ const char *msg = fcheck_open_fd(fc, fd);
+ if( msg != NULL ){
+  close(fd);
+  return msg;
+ }
+ fc->owns_fd = true;
+ return NULL;
+}
+
+//Bring an image opened by the caller into memory with the context's backend
+//mmap maps the whole file, advising the kernel that the metadata is needed and the rest is read at random;
+//pread and direct read the boot block and superblock, then the rest through io_load()
+//returns NULL on success or a message saying why the image can't be checked, fd is never closed
+const char* fcheck_open_fd(struct fcheck *fc, int fd){
+ const char *msg = NULL;
+ struct stat st;										//stats about image file
+
+ if(fstat(fd, &st) != 0){									//used for determining mmap size
+  return "image could not be read.";
+ }
+ off_t size = S_ISBLK(st.st_mode) ? lseek(fd, 0, SEEK_END) : st.st_size;			//block devices report no size
+ if(size < 0){											//the device could not be sized
+  return "image size could not be read.";
+ }
+ if(size < (off_t)(2 * GEO_BSIZE(LG_MIN))){							//need at least the boot block and the superblock
+  return "image too small.";
+ }
+ fc->fsfd = fd;
+ fc->owns_fd = false;
+ fc->image_size = size;
+
+ if(fc->io == FCHECK_IO_MMAP){
+  fc->addr = mmap(NULL, fc->image_size, PROT_READ, MAP_PRIVATE, fd, 0);				//mmap image file
+ } else {
+  fc->addr = mmap(NULL, (fc->image_size + IO_ALIGN - 1) & ~(size_t)(IO_ALIGN - 1), PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);				//buffer the backend reads into
+ }
+ if(fc->addr == MAP_FAILED){									//exit with error is map fails
+  fc->addr = NULL;
+  fc->fsfd = -1;
+  return "image could not be mapped.";
+ }
+ fc->owns_map = true;
+
+ fc->lg = LG_MAX;										//first read covers the superblock of every geometry
+ if(fc->io != FCHECK_IO_MMAP && !io_read(fc, 0, 2)){
+  msg = "image could not be read.";
+ } else {
+  msg = fcheck_prepare(fc);
+ }
+ if(msg != NULL) {fcheck_close(fc);}
+ return msg;
+}
+
+//Check an image the caller already holds in memory, size bytes at buf are read in place
+//returns NULL on success or a message saying why the image can't be checked
+const char* fcheck_open_buffer(struct fcheck *fc, const void *buf, size_t size){
+ if(size < 2 * GEO_BSIZE(LG_MIN)){								//need at least the boot block and the superblock
+  return "image too small.";
+ }
+ fc->addr = (char *)buf;									//never written, the checks only read the image
+ fc->image_size = size;
+ fc->fsfd = -1;
+ fc->owns_fd = fc->owns_map = false;
+
+ const char *msg = fcheck_prepare(fc);
+ if(msg != NULL) {fcheck_close(fc);}
+ return msg;
+}
+
+//Let go of the image of a context, unmapping or closing only what the context opened itself
+//its arena is kept for the next image
+void fcheck_close(struct fcheck *fc){
+ if (fc->owns_map) {munmap(fc->addr, fc->image_size);}
+ if (fc->owns_fd) {close(fc->fsfd);}
+ fc->addr = NULL;
+ fc->sb = NULL;
+ fc->owners = NULL;
+ fc->paths_ready = false;
+ fc->fsfd = -1;
+ fc->owns_fd = fc->owns_map = false;
+}
+
+//Empty the arena of a context and lay out the per-image state for the open image
+//the arena is sized from the superblock, with slack for the error lists and deques that grow,
+//and is kept between images, so a context checking many images maps memory for the largest one
+//with a memory limit the arena is never bigger than the limit
+static void fcheck_reset(struct fcheck *fc){
+ uint ninodes = fc->sb->ninodes + 1;
+
+ if (!arena_reserve(&fc->arena, fcheck_arena_size(fc))){
+  fail(fc, FCHECK_ERR_NO_MEMORY, -1, -1, NULL);
+ }
+ fc->active_inode_list = (ushort *)fcheck_alloc(fc, ninodes * sizeof(ushort));
+ fc->dir_visited = (uint64_t *)fcheck_alloc(fc, MAP_WORDS(ninodes) * sizeof(uint64_t));
+ fc->parent = (uint *)fcheck_alloc(fc, ninodes * sizeof(uint));
+ fc->dotdot = (uint *)fcheck_alloc(fc, ninodes * sizeof(uint));
+ fc->walk_from = (uint64_t *)fcheck_alloc(fc, ninodes * sizeof(uint64_t));
+ fc->walk_order = (uint64_t *)fcheck_alloc(fc, ninodes * sizeof(uint64_t));
+ fc->walk_gen = 0;
+ fc->path_links = NULL;
+ fc->path_names = NULL;
+ if (fc->want_paths && ninodes <= UINT_MAX / PATH_SLOT){					//name offsets must fit the low half of a link
+  fc->path_links = (uint64_t *)fcheck_alloc(fc, ninodes * sizeof(uint64_t));
+  fc->path_names = (char *)fcheck_alloc(fc, (size_t)ninodes * PATH_SLOT);
+ }
+ fc->paths_ready = false;
+ fc->inodes.type = (uchar *)fcheck_alloc(fc, ninodes * sizeof(uchar));
+ fc->inodes.nlink = (short *)fcheck_alloc(fc, ninodes * sizeof(short));
+ fc->inodes.size = (uint *)fcheck_alloc(fc, ninodes * sizeof(uint));
+
+ fcheck_map(fc, &fc->block_used, fc->sb->size);
+ fc->owners = (uint64_t *)fcheck_alloc(fc, ((size_t)fc->sb->size + 1) * sizeof(uint64_t));	//addresses up to sb->size are claimed
+ fc->owners_complete = false;
+ fc->addr_error = fc->dup_error = fc->walk_error = FCHECK_ERR_NONE;
+ fc->inode_errors = fc->name_errors = 0;
+ fc->dup_inum = -1;
+ fc->dup_block = -1;
+ fc->addr_inum = -1;
+ fc->addr_block = -1;
+ fc->walk_error_inum = -1;
+ memset(fc->walk_error_name, 0, sizeof(fc->walk_error_name));
+ for (int k = 0; k < FCHECK_NERRORS; k++) {result_set(&fc->flagged[k], k, -1, -1, NULL);}
+ fc->walk_pending = 0;
+ fc->out_of_memory = 0;
+ memset(&fc->errors, 0, sizeof(fc->errors));
+}
+
+//Run every check on the open image
+//the first error jumps back to fc->bail, with --all the errors are collected in fc->errors
+static void fcheck_checks(struct fcheck *fc){
+ fcheck_reset(fc);
+
+ //visit every inode once, checking inode types, the root inode and bitmap allocation
+ //split across nthreads threads when -j is given
+ scan_inodes(fc);
+
+ //walk the directories and report the remaining test cases for file system
+ fcheck_schedule(fc);
+
+ if (fc->out_of_memory){									//an error list could not grow with --all
+  fail(fc, FCHECK_ERR_NO_MEMORY, -1, -1, NULL);
+ }
+}
+
+int fcheck_run(struct fcheck *fc){
+ int i;
+
+ fc->result = FCHECK_ERR_NONE;
+ if (setjmp(fc->bail) == 0){
+  fcheck_checks(fc);
+  if (fc->errors.count > 0) {qsort(fc->errors.errors, fc->errors.count, sizeof(struct fcheck_result), compare_errors);}
+ } else {
+  stop_helper(fc);										//the walk ran out of memory while the helper was running
+ }
+ for (i = 0; i < fc->errors.count && fc->on_error != NULL; i++){
+  fc->on_error(fc->arg, &fc->errors.errors[i]);
+ }
+ return fc->errors.count;
+}
+
+struct fcheck* fcheck_create(const struct fcheck_options *opts){
+ struct fcheck *fc = malloc(sizeof(struct fcheck));
+ if (fc == NULL) {return NULL;}
+ fcheck_init(fc);
+ if (opts != NULL){
+  fc->nthreads = (opts->nthreads > 0) ? opts->nthreads : 1;
+  fc->all_mode = opts->all;
+  fc->want_paths = opts->paths;
+  fc->mem_limit = opts->mem_limit;
+  fc->io = (opts->io > 0 && opts->io < FCHECK_NIO) ? opts->io : FCHECK_IO_MMAP;
+  fc->block_size = opts->block_size;
+  fc->on_error = opts->on_error;
+  fc->arg = opts->arg;
+ }
+ return fc;
+}
+
+void fcheck_destroy(struct fcheck *fc){
+ if (fc == NULL) {return;}
+ if (fc->addr != NULL) {fcheck_close(fc);}
+ fcheck_free(fc);
+ free(fc);
+}
+
+const struct fcheck_result* fcheck_results(struct fcheck *fc, int *count){
+ *count = fc->errors.count;
+ return fc->errors.errors;
+}
+
+const char* fcheck_strerror(int err){
+ if (err == FCHECK_ERR_NONE) {return "no error.";}
+ if (err < 0 || err >= FCHECK_NERRORS) {return "unknown error.";}
+ return error_info[err].msg;
+}
+
+bool fcheck_who_owns(struct fcheck *fc, long block, struct fcheck_owner *o){
+ memset(o, 0, sizeof(*o));
+ o->inum = o->offset = -1;
+ if (fc->owners == NULL || !fc->owners_complete || block < 0 || block >= fc->sb->size) {return false;}
+ uint64_t e = fc->owners[block];
+ if (e != 0){
+  o->role = OWNER_ROLE(e);
+  o->inum = OWNER_INUM(e);
+  o->offset = (o->role == FCHECK_ROLE_INDIRECT_BLOCK) ? -1 : OWNER_OFFSET(e);
+  o->shared = (e & OWNER_SHARED) != 0;
+ }
+ return true;
+}
+
+int fcheck_path(struct fcheck *fc, int inum, char *buf, size_t size){
+ size_t len = 0, pos, k;
+ uint i, depth;
+ if (fc->sb == NULL || !fc->paths_ready || inum < 1 || inum > (int)fc->sb->ninodes) {return -1;}
+
+ //climb to the root for the length first, a cycle of links never gets there
+ for (i = inum, depth = 0; i != ROOTINO; i = fc->path_links[i] >> 32, depth++){
+  if (fc->path_links[i] == 0 || depth > fc->sb->ninodes) {return -1;}
+  len += 1 + strlen(fc->path_names + (uint)fc->path_links[i]);
+ }
+ if (len == 0) {len = 1;}									//the root itself
+
+ //then write the names from the end, keeping what fits
+ if (size == 0) {return (int)len;}
+ if (size > 1) {buf[0] = '/';}
+ for (i = inum, pos = len; i != ROOTINO; i = fc->path_links[i] >> 32){
+  const char *name = fc->path_names + (uint)fc->path_links[i];
+  size_t n = strlen(name);
+  pos -= n;
+  for (k = 0; k < n && pos + k < size - 1; k++) {buf[pos + k] = name[k];}
+  if (--pos < size - 1) {buf[pos] = '/';}
+ }
+ buf[MIN(len, size - 1)] = '\0';
+ return (int)len;
+}
+
+int fcheck_test_number(int err){
+ return (err > 0 && err < FCHECK_NERRORS) ? error_info[err].test : 0;
+}
+
+int fcheck_io_parse(const char *name){
+ int io;
+ for (io = 0; io < FCHECK_NIO; io++){
+  if (strcmp(name, io_names[io]) == 0) {return io;}
+ }
+ return -1;
+}
@@ -67,7 +67,6 @@ xint(uint x)
 int 
 mkfs(int nblocks, int ninodes, int size) {
 
-  int i;
   char buf[BLOCK_SIZE];
 
   sb.size = xint(size);
@@ -83,8 +82,11 @@ mkfs(int nblocks, int ninodes, int size) {
 
   assert(nblocks + usedblocks == size);
 
-  for(i = 0; i < nblocks + usedblocks; i++)
-    wsect(i, zeroes);
+  // the image was truncated on open, extending it zeroes every block without writing them one by one
+  if(ftruncate(fsfd, (off_t)size * 512) != 0){
+    perror("ftruncate");
+    exit(1);
+  }
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -204,9 +206,16 @@ main(int argc, char *argv[])
   DIR *root_dir;
 
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs fs.img [dir [size [ninodes]]]\n");
     exit(1);
   }
+  if(argc > 3)
+    size = atoi(argv[3]);
+  if(argc > 4)
+    ninodes = atoi(argv[4]);
+  // boot block, superblock, inode blocks and bitmap blocks come off the data blocks
+  nblocks = size - (ninodes / IPB + 3 + size / BPB + 1);
+  assert(ninodes >= IPB && nblocks > 0);
 
   assert((512 % sizeof(struct dinode)) == 0);
   assert((512 % sizeof(struct xv6_dirent)) == 0);
@@ -217,7 +226,7 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  mkfs(995, 200, 1024);
+  mkfs(nblocks, ninodes, size);
 
   root_dir = opendir(argv[2]);
 
@@ -311,16 +320,19 @@ void
 balloc(int used)
 {
   uchar buf[512];
-  int i;
+  int i, b;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used <= size);
+  // the bitmap spans bitblocks blocks, write the ones holding a used bit in order
+  for(b = 0; b * BPB < used; b++){
+    bzero(buf, 512);
+    for(i = b * BPB; i < used && i < (b + 1) * BPB; i++){
+      buf[(i % BPB)/8] = buf[(i % BPB)/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %zu\n", ninodes/IPB + 3 + b);
+    wsect(ninodes / IPB + 3 + b, buf);
   }
-  printf("balloc: write bitmap block at sector %zu\n", ninodes/IPB + 3);
-  wsect(ninodes / IPB + 3, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))